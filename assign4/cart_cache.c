@@ -9,53 +9,1145 @@
 //
 
 // Includes
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 // Project includes
 #include <cart_cache.h>
 #include <cart_controller.h>
 #include <cmpsc311_log.h>
 // Defines
 
+//BENCHMARK THREAD STRUCT
+typedef struct benchmark_thread_args {
+    unsigned int seed; //random seed of thread
+    int ops; //gets to run
+    int frames; //frames the traffic is spread over
+    int errors; //hits whose copy didn't hold the frame asked for
+} benchmark_thread_args;
+
+// Function Declarations
+char * slot_data(Cache*, int32_t); //gets frame data of slot
+cache_cart_stats * cart_counters(Cache*, uint32_t); //gets counters of key's cart
+cache_partition_stats * slot_part_counters(Cache*, int32_t); //gets counters of slot's partition
+void slot_write_begin(Cache*, int32_t); //starts changing slot under lockless readers
+void note_prefetch_hit(Cache*, int32_t, uint32_t); //counts first use of prefetched slot
+void slot_write_end(Cache*, int32_t); //finishes changing slot
+int shard_get_lockless(Cache*, uint32_t, void*); //copies frame out without the shard lock
+void note_access(uint32_t, int); //samples access for miss ratio curve
+int resize_cart_cache(int); //changes size of running cache
+void autotune_cart_cache(void); //resizes cache to knee of miss ratio curve
+void remove_slot(Cache*, int32_t, int); //takes slot out of cache
+uint32_t index_home(cache_index*, uint32_t); //gets first entry to look at for key
+int sketch_init(cache_sketch*, int); //creates sketch
+void sketch_free(cache_sketch*); //releases sketch
+void sketch_add(cache_sketch*, uint32_t); //counts an access to key
+int sketch_estimate(cache_sketch*, uint32_t); //gets access count of key
+int admit_frame(Cache*, uint32_t, int32_t); //decides whether key may evict slot
+Cache * shard_of(uint32_t); //picks shard of key
+int shard_init(Cache*, int); //creates shard
+void shard_close(Cache*); //releases shard
+int init_unwind(int); //releases what a failed init set up
+int32_t shard_reserve(Cache*, uint32_t, int, int*); //finds or makes slot of frame in locked shard
+void shard_put(Cache*, uint32_t, int, void*); //puts frame into locked shard
+int32_t shard_get(Cache*, uint32_t, int); //finds frame in locked shard
+void * benchmark_thread(void*); //random traffic of one benchmark thread
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slot_data
+// Description  : Gets the frame data of a cache slot
+//
+// Inputs       : c - the cache
+//                slot - index of the slot
+// Outputs      : pointer to CART_FRAME_SIZE bytes of frame data
+
+char * slot_data(Cache *c, int32_t slot) {
+    return(&c->payload[(size_t)slot * CART_FRAME_SIZE]); //payloads are packed in slot order
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_counters
+// Description  : Gets the counters a shard keeps for the cart of a key
+//
+// Inputs       : c - the cache
+//                key - index key of a frame
+// Outputs      : counters of the frame's cart
+
+cache_cart_stats * cart_counters(Cache *c, uint32_t key) {
+    return(&c->carts[CART_CACHE_KEY_CART(key) % CART_MAX_CARTRIDGES]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slot_part_counters
+// Description  : Gets the counters a shard keeps for the partition a slot
+//                is charged to, which lockless readers may see change
+//
+// Inputs       : c - the cache
+//                slot - a slot holding a frame
+// Outputs      : counters of the slot's partition
+
+cache_partition_stats * slot_part_counters(Cache *c, int32_t slot) {
+    return(&c->parts[__atomic_load_n(&c->slot_parts[slot], __ATOMIC_RELAXED)]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slot_write_begin
+// Description  : Marks a slot as changing by making its sequence odd, so a
+//                lockless reader that copies it meanwhile throws the copy away
+//
+// Inputs       : c - the cache
+//                slot - index of the slot
+// Outputs      : none
+
+void slot_write_begin(Cache *c, int32_t slot) {
+    __atomic_store_n(&c->seqs[slot], c->seqs[slot] + 1, __ATOMIC_RELAXED); //odd while changing
+    __atomic_thread_fence(__ATOMIC_RELEASE); //odd sequence is seen before any change
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slot_write_end
+// Description  : Marks a slot as stable again with a new even sequence
+//
+// Inputs       : c - the cache
+//                slot - index of the slot
+// Outputs      : none
+
+void slot_write_end(Cache *c, int32_t slot) {
+    __atomic_store_n(&c->seqs[slot], c->seqs[slot] + 1, __ATOMIC_RELEASE); //changes are seen before even sequence
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : note_prefetch_hit
+// Description  : Counts the first use of a prefetched slot. The flag is
+//                cleared atomically, so two lockless readers count it once.
+//
+// Inputs       : c - the cache
+//                slot - index of the slot
+//                key - index key of the frame
+// Outputs      : none
+
+void note_prefetch_hit(Cache *c, int32_t slot, uint32_t key) {
+    if(!(__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PREFETCHED)) return; //most slots weren't prefetched
+    if(__atomic_fetch_and(&c->nodes[slot].flags, ~CART_CACHE_SLOT_PREFETCHED, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PREFETCHED) {
+        __atomic_fetch_add(&cart_counters(c, key)->prefetch_hits, 1, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : list_unlink
+// Description  : Takes a slot (or ghost) off the list it is on
+//
+// Inputs       : c - the cache
+//                nodes - the slots or ghosts array
+//                slot - index of the slot
+// Outputs      : none
+
+void list_unlink(Cache *c, cache_node *nodes, int32_t slot) {
+    cache_node *node = &nodes[slot]; //slot to unlink
+    cache_list *list = &c->lists[node->list]; //list slot is on
+
+    if(node->prev != CART_CACHE_NONE) { //if slot has a newer slot
+        nodes[node->prev].next = node->next; //newer slot skips over slot
+    } else { //if slot is tail
+        list->tail = node->next; //older slot becomes tail
+    }
+    if(node->next != CART_CACHE_NONE) { //if slot has an older slot
+        nodes[node->next].prev = node->prev; //older slot skips over slot
+    } else { //if slot is head
+        list->head = node->prev; //newer slot becomes head
+    }
+    node->next = CART_CACHE_NONE; //set next to none
+    node->prev = CART_CACHE_NONE; //set prev to none
+    list->size--; //one less on list
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : list_push
+// Description  : Makes a slot (or ghost) the newest (tail) on a list
+//
+// Inputs       : c - the cache
+//                nodes - the slots or ghosts array
+//                list - the list to push onto
+//                slot - index of the slot
+// Outputs      : none
+
+void list_push(Cache *c, cache_node *nodes, int list, int32_t slot) {
+    cache_node *node = &nodes[slot]; //slot to push
+    cache_list *to = &c->lists[list]; //list to push onto
+
+    node->list = list; //remember list
+    node->prev = CART_CACHE_NONE; //nothing is newer
+    node->next = to->tail; //current tail is older
+    if(to->tail != CART_CACHE_NONE) { //if list has slots
+        nodes[to->tail].prev = slot; //point tail prev to slot
+    } else { //if list is empty
+        to->head = slot; //slot is also head
+    }
+    to->tail = slot; //set tail to slot
+    to->size++; //one more on list
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghost_find
+// Description  : Finds the ghost of a frame evicted from the cache
+//
+// Inputs       : c - the cache
+//                key - index key of the frame
+// Outputs      : ghost if found, CART_CACHE_NONE if not
+
+int32_t ghost_find(Cache *c, uint32_t key) {
+    if(c->ghosts == NULL) return(CART_CACHE_NONE); //policy keeps no ghosts
+    return(index_find(&c->ghost_index, key));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghost_add
+// Description  : Remembers a frame evicted from the cache on a ghost list.
+//                If every ghost is used, the oldest ghost on the list is
+//                forgotten first.
+//
+// Inputs       : c - the cache
+//                list - the ghost list
+//                key - index key of the frame
+// Outputs      : none
+
+void ghost_add(Cache *c, int list, uint32_t key) {
+    int32_t ghost; //ghost to use
+
+    if(c->ghosts == NULL) return; //policy keeps no ghosts
+    if(c->free_ghosts == CART_CACHE_NONE) { //if every ghost is used
+        if(c->lists[list].head == CART_CACHE_NONE) return; //nothing to forget on this list
+        ghost_remove(c, c->lists[list].head); //forget oldest
+    }
+
+    ghost = c->free_ghosts; //take unused ghost
+    c->free_ghosts = c->ghosts[ghost].next; //remove it from free list
+    c->ghosts[ghost].cart = CART_CACHE_KEY_CART(key); //set cart
+    c->ghosts[ghost].frame = CART_CACHE_KEY_FRAME(key); //set frame
+    list_push(c, c->ghosts, list, ghost); //ghost is newest on list
+    index_insert(&c->ghost_index, key, ghost); //add ghost to index
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghost_remove
+// Description  : Forgets a ghost
+//
+// Inputs       : c - the cache
+//                ghost - the ghost to forget
+// Outputs      : none
+
+void ghost_remove(Cache *c, int32_t ghost) {
+    list_unlink(c, c->ghosts, ghost); //take ghost off its list
+    index_remove(&c->ghost_index, CART_CACHE_KEY(c->ghosts[ghost].cart, c->ghosts[ghost].frame)); //remove ghost from index
+    c->ghosts[ghost].next = c->free_ghosts; //give ghost back to free list
+    c->free_ghosts = ghost; //ghost is unused again
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : remove_slot
+// Description  : Takes a slot out of the cache and gives it back to the free
+//                list
+//
+// Inputs       : c - the cache
+//                slot - the slot to remove
+//                evicted - 1 if removed to make room, 0 if deleted
+// Outputs      : none
+
+void remove_slot(Cache *c, int32_t slot, int evicted) {
+    if(evicted) tier2_store(&cache.tier2, CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame), slot_data(c, slot)); //victim goes to second tier
+    if(evicted) __atomic_fetch_add(&cart_counters(c, CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame))->evictions, 1, __ATOMIC_RELAXED);
+    if(__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PREFETCHED) __atomic_fetch_add(&cart_counters(c, CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame))->prefetch_wasted, 1, __ATOMIC_RELAXED);
+    if(__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PINNED) { //pinned slots are only deleted, never evicted
+        c->pinned--;
+        __atomic_fetch_sub(&cache.pinned, 1, __ATOMIC_RELAXED);
+    } else {
+        c->policy->remove(c, slot, evicted); //policy lets go of slot
+        partition_remove(c, slot, evicted); //partition lets go of slot
+        c->current_cache_size--; //decrement the current size of cache
+    }
+    index_remove(&c->filled_cache_frames, CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame)); //remove the slot from index
+    if(!(c->seqs[slot] & 1)) slot_write_begin(c, slot); //unless a reservation already has it changing
+    __atomic_store_n(&c->nodes[slot].flags, 0, __ATOMIC_RELAXED); //slot is unused
+    slot_write_end(c, slot);
+    c->nodes[slot].next = c->free_nodes; //give slot back to free list
+    c->free_nodes = slot; //slot is unused again
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : index_init
+// Description  : Creates an index with room for "capacity" keys, using a
+//                power of two table kept at most half full
+//
+// Inputs       : index, capacity
+// Outputs      : 0 if successful, -1 if failure
+
+int index_init(cache_index *index, int capacity) {
+    uint32_t size = 16; //smallest table
+
+    while(size < (uint32_t)capacity * 2) size <<= 1; //at most half full
+    index->entries = (uint64_t *) calloc(size, sizeof(uint64_t)); //every entry empty
+    if(index->entries == NULL) return(-1); //if allocation fails
+    index->mask = size - 1;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : index_free
+// Description  : Releases an index
+//
+// Inputs       : index
+// Outputs      : none
+
+void index_free(cache_index *index) {
+    free(index->entries); //release table
+    index->entries = NULL;
+    index->mask = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : index_home
+// Description  : Gets the entry where the search for a key starts
+//
+// Inputs       : index, key
+// Outputs      : entry number
+
+uint32_t index_home(cache_index *index, uint32_t key) {
+    return((uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & index->mask); //fibonacci hash spreads cart and frame bits
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : index_find
+// Description  : Finds the slot of a key
+//
+// Inputs       : index, key
+// Outputs      : slot if found, CART_CACHE_NONE if not
+
+int32_t index_find(cache_index *index, uint32_t key) {
+    uint32_t i = index_home(index, key); //entry to look at
+    uint64_t entry; //entry being looked at
+
+    while((entry = __atomic_load_n(&index->entries[i], __ATOMIC_ACQUIRE)) != 0) { //go until an empty entry, entries may change under lockless readers
+        if((entry >> 32) == (uint64_t)key + 1) return((int32_t)(uint32_t)entry); //found key
+        i = (i + 1) & index->mask; //try next entry
+    }
+    return(CART_CACHE_NONE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : index_insert
+// Description  : Adds a key that isn't in the index yet
+//
+// Inputs       : index, key, slot
+// Outputs      : none
+
+void index_insert(cache_index *index, uint32_t key, int32_t slot) {
+    uint32_t i = index_home(index, key); //entry to look at
+
+    while(index->entries[i] != 0) i = (i + 1) & index->mask; //find empty entry
+    __atomic_store_n(&index->entries[i], (((uint64_t)key + 1) << 32) | (uint32_t)slot, __ATOMIC_RELEASE); //store key and slot in one write
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : index_remove
+// Description  : Removes a key, shifting later entries back so no search
+//                stops early at the hole
+//
+// Inputs       : index, key
+// Outputs      : none
+
+void index_remove(cache_index *index, uint32_t key) {
+    uint32_t i = index_home(index, key), j, home; //entry of key, entry after it and where that one belongs
+
+    while(index->entries[i] != 0 && (index->entries[i] >> 32) != (uint64_t)key + 1) i = (i + 1) & index->mask; //find key
+    if(index->entries[i] == 0) return; //key not in index
+
+    j = i;
+    while(1) { //fill hole with any later entry that may move back
+        j = (j + 1) & index->mask;
+        if(index->entries[j] == 0) break; //end of run
+        home = index_home(index, (uint32_t)(index->entries[j] >> 32) - 1); //where entry belongs
+        if(((j - home) & index->mask) >= ((j - i) & index->mask)) { //if hole is between home and entry
+            __atomic_store_n(&index->entries[i], index->entries[j], __ATOMIC_RELEASE); //move entry back
+            i = j; //its old place is the new hole
+        }
+    }
+    __atomic_store_n(&index->entries[i], 0, __ATOMIC_RELEASE); //empty the hole
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketch_init
+// Description  : Creates a count-min sketch with a row of counters a few
+//                times wider than the cache, so frames that are cached
+//                rarely share all of their counters
+//
+// Inputs       : sketch - the sketch to create
+//                capacity - number of frames the cache holds
+// Outputs      : 0 if successful, -1 if failure
+
+int sketch_init(cache_sketch *sketch, int capacity) {
+    uint32_t width = 64; //counters per row
+
+    while(width < (uint32_t)capacity * 4) width <<= 1; //power of two for masking
+    sketch->counters = (uint8_t *) calloc((size_t)width * CART_CACHE_SKETCH_ROWS, sizeof(uint8_t)); //all counts start at 0
+    if(sketch->counters == NULL) return(-1); //if allocation fails
+    sketch->mask = width - 1;
+    sketch->additions = 0;
+    sketch->sample_size = width * CART_CACHE_SKETCH_SAMPLE;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketch_free
+// Description  : Releases the counters of a sketch
+//
+// Inputs       : sketch - the sketch to release
+// Outputs      : none
+
+void sketch_free(cache_sketch *sketch) {
+    free(sketch->counters);
+    sketch->counters = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketch_add
+// Description  : Counts an access to a key in every row. Once enough
+//                accesses are counted every counter is halved, so old
+//                popularity fades and the sketch follows the workload.
+//
+// Inputs       : sketch - the sketch
+//                key - index key of frame accessed
+// Outputs      : none
+
+void sketch_add(cache_sketch *sketch, uint32_t key) {
+    uint32_t row, i, width = sketch->mask + 1; //row, counter and counters per row
+    uint64_t hash = ((uint64_t)key + 1) * 0x9E3779B97F4A7C15ULL; //one hash split across rows
+
+    for(row = 0; row < CART_CACHE_SKETCH_ROWS; row++) { //count in each row
+        i = row * width + ((uint32_t)(hash >> (row * 16)) & sketch->mask);
+        if(sketch->counters[i] < CART_CACHE_SKETCH_MAX) sketch->counters[i]++;
+    }
+
+    if(++sketch->additions >= sketch->sample_size) { //if time to age
+        for(i = 0; i < width * CART_CACHE_SKETCH_ROWS; i++) sketch->counters[i] >>= 1;
+        sketch->additions /= 2;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketch_estimate
+// Description  : Gets how often a key was accessed lately, the smallest of
+//                its counters
+//
+// Inputs       : sketch - the sketch
+//                key - index key of frame
+// Outputs      : estimated access count
+
+int sketch_estimate(cache_sketch *sketch, uint32_t key) {
+    uint32_t row, i, width = sketch->mask + 1; //row, counter and counters per row
+    uint64_t hash = ((uint64_t)key + 1) * 0x9E3779B97F4A7C15ULL; //one hash split across rows
+    int count = CART_CACHE_SKETCH_MAX; //smallest count seen
+
+    for(row = 0; row < CART_CACHE_SKETCH_ROWS; row++) { //check each row
+        i = row * width + ((uint32_t)(hash >> (row * 16)) & sketch->mask);
+        if(sketch->counters[i] < count) count = sketch->counters[i];
+    }
+    return(count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : admit_frame
+// Description  : Decides whether a new frame may evict the policy's victim.
+//                A frame the policy remembers as recently evicted is always
+//                admitted; otherwise it must have been used more often than
+//                the victim, so a one-off scan can't push out hot frames.
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+//                victim - slot the policy would evict
+// Outputs      : 1 if frame is admitted, 0 if not
+
+int admit_frame(Cache *c, uint32_t key, int32_t victim) {
+    if(!c->admission || c->ghost_hit != CART_CACHE_NONE) return(1); //no filter, or frame is returning
+    return(sketch_estimate(&c->sketch, key) > sketch_estimate(&c->sketch, CART_CACHE_KEY(c->nodes[victim].cart, c->nodes[victim].frame)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_of
+// Description  : Picks the shard that holds a frame. The hash differs from
+//                the one the index uses, so keys of one shard still spread
+//                over its whole index.
+//
+// Inputs       : key - index key of the frame
+// Outputs      : the shard
+
+Cache * shard_of(uint32_t key) {
+    return(&cache.shards[(uint32_t)(((uint64_t)key * 0xC2B2AE3D27D4EB4FULL) >> 40) & (cache.shard_count - 1)]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_init
+// Description  : Initialize one shard and note its maximum frames. Slot
+//                metadata and frame payloads are kept in separate arrays so
+//                list walks only touch the small metadata.
+//
+// Inputs       : c - the shard
+//                size - number of frames shard holds
+// Outputs      : 0 if successful, -1 if failure
+
+int shard_init(Cache *c, int size) {
+    int i; //iterating variable
+    void *payload = NULL; //payload region
+
+    memset(c, 0, sizeof(Cache)); //nothing allocated yet
+    c->max_cache_size = size;
+    c->capacity = size + cache.pin_budget; //slots are never reallocated, so size can only change within this
+    c->policy = cache.policy;
+    c->admission = cache.admission;
+    c->use_hugepages = cache.use_hugepages;
+    c->free_nodes = CART_CACHE_NONE; //no unused slots yet
+    c->free_ghosts = CART_CACHE_NONE; //no unused ghosts yet
+    if(pthread_mutex_init(&c->lock, NULL) != 0) return(-1);
+
+    if(c->capacity > 0) { //if cache is used, allocate every slot now
+        c->nodes = (cache_node *) calloc(c->capacity, sizeof(cache_node)); //one block for all metadata, no slot used if init stops short
+        c->seqs = (uint32_t *) calloc(c->capacity, sizeof(uint32_t)); //every slot starts stable
+        c->slot_parts = (uint8_t *) calloc(c->capacity, sizeof(uint8_t)); //set as each slot is used
+        if(c->nodes == NULL || c->seqs == NULL || c->slot_parts == NULL) return(-1); //if allocation fails
+
+        c->payload_size = (size_t)c->capacity * CART_FRAME_SIZE; //one frame per slot
+        if(c->use_hugepages) { //if asked, map payload with hugepages
+            c->payload_size = (c->payload_size + CART_CACHE_HUGEPAGE_SIZE - 1) / CART_CACHE_HUGEPAGE_SIZE * CART_CACHE_HUGEPAGE_SIZE; //whole hugepages
+            payload = mmap(NULL, c->payload_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if(payload != MAP_FAILED) { //if hugepages were free
+                c->payload_mapped = 1;
+            } else { //otherwise align to a hugepage and let the kernel merge pages
+                payload = NULL;
+                if(posix_memalign(&payload, CART_CACHE_HUGEPAGE_SIZE, c->payload_size) == 0) {
+                    madvise(payload, c->payload_size, MADV_HUGEPAGE);
+                }
+            }
+        } else if(posix_memalign(&payload, 4096, c->payload_size) != 0) { //page aligned payload
+            payload = NULL;
+        }
+        if(payload == NULL) { //if allocation fails
+            free(c->nodes);
+            c->nodes = NULL;
+            return(-1);
+        }
+        c->payload = (char *) payload;
+
+        for(i = c->capacity - 1; i >= 0; i--) { //put every slot on the free list
+            c->nodes[i].flags = 0;
+            c->nodes[i].prev = CART_CACHE_NONE;
+            c->nodes[i].next = c->free_nodes;
+            c->free_nodes = i;
+        }
+
+        c->max_ghosts = size; //remember as many evicted frames as cached ones
+        c->ghosts = (cache_node *) malloc(sizeof(cache_node) * c->max_ghosts); //ghosts have no payload
+        if(c->ghosts == NULL || index_init(&c->ghost_index, c->max_ghosts) == -1) return(-1); //if allocation fails
+        for(i = c->max_ghosts - 1; i >= 0; i--) { //put every ghost on the free list
+            c->ghosts[i].flags = 0;
+            c->ghosts[i].prev = CART_CACHE_NONE;
+            c->ghosts[i].next = c->free_ghosts;
+            c->free_ghosts = i;
+        }
+
+        if(c->admission && sketch_init(&c->sketch, c->capacity) == -1) return(-1); //if allocation fails
+    }
+
+    if(index_init(&c->filled_cache_frames, c->capacity) == -1) return(-1); //index sized to shard, not to carts
+
+    for(i = 0; i < CART_CACHE_LISTS; i++) { //every list starts empty
+        c->lists[i].head = CART_CACHE_NONE;
+        c->lists[i].tail = CART_CACHE_NONE;
+        c->lists[i].size = 0;
+    }
+    c->ghost_hit = CART_CACHE_NONE; //no key being added
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_close
+// Description  : Clear all of the contents of one shard, cleanup
+//
+// Inputs       : c - the shard
+// Outputs      : none
+
+void shard_close(Cache *c) {
+    int i; //iterating variable
+
+    for(i = 0; c->nodes != NULL && i < c->capacity; i++) { //go through every slot to delete
+        if(c->nodes[i].flags & CART_CACHE_SLOT_USED) remove_slot(c, i, 0);
+    }
+
+    if(c->payload_mapped) { //release every payload at once
+        munmap(c->payload, c->payload_size);
+    } else {
+        free(c->payload);
+    }
+    free(c->nodes); //release every slot at once
+    free(c->seqs); //release every sequence at once
+    free(c->slot_parts); //release every partition at once
+    free(c->ghosts); //release every ghost at once
+    index_free(&c->filled_cache_frames); //release index
+    index_free(&c->ghost_index); //release ghost index
+    sketch_free(&c->sketch); //release admission sketch
+    pthread_mutex_destroy(&c->lock);
+    c->payload = NULL; //no payloads left
+    c->payload_mapped = 0; //payload not mapped
+    c->nodes = NULL; //no slots left
+    c->seqs = NULL; //no sequences left
+    c->slot_parts = NULL; //no partitions left
+    c->ghosts = NULL; //no ghosts left
+    c->free_nodes = CART_CACHE_NONE; //no unused slots left
+    c->free_ghosts = CART_CACHE_NONE; //no unused ghosts left
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_reserve
+// Description  : Find or make the slot of a frame in one shard, the shard is
+//                locked. The slot is left changing (odd sequence) for the
+//                caller to fill, and slot_write_end must follow.
+//
+// Inputs       : c - the shard
+//                key - index key of the frame
+//                part - partition a new slot is charged to
+//                valid - NULL if the whole frame will be written, else set
+//                        to 1 if the slot already holds the frame, 0 if not
+// Outputs      : slot of frame, CART_CACHE_NONE if frame isn't admitted
+
+int32_t shard_reserve(Cache *c, uint32_t key, int part, int *valid) {
+    int32_t slot = index_find(&c->filled_cache_frames, key); //get slot from cache storage
+    int32_t victim; //slot to evict
+
+    if(c->admission && c->last_get != key + 1) sketch_add(&c->sketch, key); //count access, unless get just did
+    c->last_get = 0; //next put is a new access
+    if(slot == CART_CACHE_NONE) { //if data not in cache
+        if(valid == NULL) tier2_drop(&cache.tier2, key); //second tier copy is older, even if frame isn't admitted
+        c->policy->miss(c, key); //let policy look for a ghost of frame
+        if(c->current_cache_size >= c->max_cache_size || partition_full(c, part)) { //if cache or frame's partition has no room
+            victim = partition_victim(c, part, c->policy->victim(c, key)); //slot chosen by policy, unless its partition must keep it
+            if(!admit_frame(c, key, victim)) { //if frame is colder than victim
+                __atomic_fetch_add(&cart_counters(c, key)->rejected, 1, __ATOMIC_RELAXED);
+                return(CART_CACHE_NONE); //frame is still on cart, just not cached
+            }
+            remove_slot(c, victim, 1); //evict slot chosen by policy
+        }
+
+        slot = c->free_nodes; //take unused slot
+        c->free_nodes = c->nodes[slot].next; //remove it from free list
+        slot_write_begin(c, slot);
+        __atomic_store_n(&c->nodes[slot].cart, CART_CACHE_KEY_CART(key), __ATOMIC_RELAXED); //set cart, lockless readers may look
+        __atomic_store_n(&c->nodes[slot].frame, CART_CACHE_KEY_FRAME(key), __ATOMIC_RELAXED); //set frame
+        __atomic_store_n(&c->nodes[slot].flags, CART_CACHE_SLOT_USED, __ATOMIC_RELAXED); //slot holds a frame
+        c->nodes[slot].next = CART_CACHE_NONE; //not on a list yet
+        c->nodes[slot].prev = CART_CACHE_NONE; //not on a list yet
+        c->current_cache_size++; //increase current cache size
+        partition_insert(c, key, part, slot); //charge slot to caller's partition
+        if(valid != NULL) { //old data is wanted, second tier or shared memory may have it
+            *valid = (tier2_load(&cache.tier2, key, slot_data(c, slot)) == 0 || shared_load(&cache.shared, key, slot_data(c, slot)) == 0);
+            __atomic_fetch_add(&cart_counters(c, key)->misses, 1, __ATOMIC_RELAXED); //a miss in memory, as for gets; the tier filling it counts the hit
+            __atomic_fetch_add(&c->parts[part].misses, 1, __ATOMIC_RELAXED);
+        }
+        index_insert(&c->filled_cache_frames, key, slot); //add slot to the filled frames, readers wait for even sequence
+        __atomic_fetch_add(&cart_counters(c, key)->insertions, 1, __ATOMIC_RELAXED);
+        c->policy->insert(c, slot); //policy places slot
+        c->ghost_hit = CART_CACHE_NONE; //done adding key
+    } else { //if data is already in cache
+        if(!(__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PINNED)) c->policy->hit(c, slot); //policy notes use of slot
+        slot_write_begin(c, slot);
+        if(valid != NULL) { //old data is read, so this is a hit
+            *valid = 1;
+            __atomic_fetch_add(&cart_counters(c, key)->hits, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&slot_part_counters(c, slot)->hits, 1, __ATOMIC_RELAXED);
+        }
+        note_prefetch_hit(c, slot, key); //a write uses the prefetch too
+    }
+    return(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_put
+// Description  : Put a frame into one shard, the shard is locked
+//
+// Inputs       : c - the shard
+//                key - index key of the frame
+//                part - partition a new slot is charged to
+//                buf - the buffer to insert into the cache
+// Outputs      : none
+
+void shard_put(Cache *c, uint32_t key, int part, void *buf) {
+    int32_t slot = shard_reserve(c, key, part, NULL); //slot to copy into
+
+    if(slot == CART_CACHE_NONE) return; //frame not admitted
+    memcpy(slot_data(c, slot), buf, CART_FRAME_SIZE); //copy new data from buf into slot
+    slot_write_end(c, slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_get
+// Description  : Find a frame in one shard, the shard is locked
+//
+// Inputs       : c - the shard
+//                key - index key of the frame
+//                part - partition a miss is charged to
+// Outputs      : slot of frame, CART_CACHE_NONE if not found
+
+int32_t shard_get(Cache *c, uint32_t key, int part) {
+    int32_t slot; //slot in cache
+
+    if(c->admission) sketch_add(&c->sketch, key); //count access
+    c->last_get = key + 1; //put that follows is the same access
+    slot = index_find(&c->filled_cache_frames, key); //get slot in cache
+    if(slot == CART_CACHE_NONE) { //frame not in cache
+        __atomic_fetch_add(&cart_counters(c, key)->misses, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&c->parts[part].misses, 1, __ATOMIC_RELAXED);
+        return(CART_CACHE_NONE);
+    }
+
+    __atomic_fetch_add(&cart_counters(c, key)->hits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot_part_counters(c, slot)->hits, 1, __ATOMIC_RELAXED);
+    note_prefetch_hit(c, slot, key);
+    if(!(__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PINNED)) c->policy->hit(c, slot); //policy notes use of slot
+    return(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shard_get_lockless
+// Description  : Copies a frame out of a shard without taking its lock. The
+//                slot's sequence is read before and after the copy, and the
+//                copy is only kept if the slot still held the frame and did
+//                not change in between. Only policies whose hit is a lone
+//                atomic flag update can note the use, so other policies and
+//                the admission sketch always go through the lock.
+//
+// Inputs       : c - the shard
+//                key - index key of the frame
+//                buf - CART_FRAME_SIZE bytes to copy the frame into
+// Outputs      : 0 if copied, -1 if the locked path must be taken
+
+int shard_get_lockless(Cache *c, uint32_t key, void *buf) {
+    int32_t slot; //slot of frame
+    uint32_t seq; //sequence of slot before copy
+    cache_node *node; //metadata of slot
+
+    if(!c->policy->lockless_hit || c->admission) return(-1); //use must be noted under lock
+    slot = index_find(&c->filled_cache_frames, key); //may miss a key being moved, locked path settles it
+    if(slot == CART_CACHE_NONE) return(-1);
+
+    node = &c->nodes[slot];
+    seq = __atomic_load_n(&c->seqs[slot], __ATOMIC_ACQUIRE);
+    if(seq & 1) return(-1); //slot is changing
+    if(!(__atomic_load_n(&node->flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_USED) ||
+        CART_CACHE_KEY(__atomic_load_n(&node->cart, __ATOMIC_RELAXED), __atomic_load_n(&node->frame, __ATOMIC_RELAXED)) != key) return(-1); //slot was reused
+    memcpy(buf, slot_data(c, slot), CART_FRAME_SIZE); //copy, may be torn until checked below
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); //copy is done before sequence is read again
+    if(__atomic_load_n(&c->seqs[slot], __ATOMIC_RELAXED) != seq) return(-1); //slot changed during copy
+
+    c->policy->hit(c, slot); //policy notes use of slot
+    __atomic_fetch_add(&cart_counters(c, key)->hits, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&slot_part_counters(c, slot)->hits, 1, __ATOMIC_RELAXED);
+    note_prefetch_hit(c, slot, key);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_size
+// Description  : Set the size of the cache. Before init it sets the size
+//                init allocates; on a running cache it resizes, shrinking
+//                or growing back up to the size at init.
+//
+// Inputs       : max_frames - the maximum number of items your cache can hold
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_size(uint32_t max_frames) {
+    if(cache.shards != NULL) return(resize_cart_cache(max_frames)); //cache is running
+    cache.max_cache_size = max_frames; //sets max cache size;
+    return(0); //successfully sets cache size
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resize_cart_cache
+// Description  : Changes the size of a running cache. Slots are never
+//                reallocated, since lockless readers may be looking at
+//                them, so the cache can shrink and then grow back up to its
+//                size at init. Shrinking evicts the policy's victims, as
+//                partitions allow, so none goes below its minimum while
+//                another is over its own.
+//
+// Inputs       : frames - the new size
+// Outputs      : 0 if successful, -1 if failure
+
+int resize_cart_cache(int frames) {
+    int i, size, from = cache.max_cache_size; //shard, size of shard, size before
+    int32_t victim; //slot policy would evict
+    Cache *c; //shard
+
+    if(frames > cache.capacity) frames = cache.capacity; //can't grow past slots allocated
+    if(frames < cache.shard_count) frames = cache.shard_count; //every shard holds a frame
+    cache.max_cache_size = frames; //partition shares are taken of the new size
+    partition_resize(from, frames); //partitions keep their share
+    for(i = 0; i < cache.shard_count; i++) { //split frames the way init did
+        c = &cache.shards[i];
+        size = frames / cache.shard_count + (i < frames % cache.shard_count);
+        pthread_mutex_lock(&c->lock);
+        c->max_cache_size = size;
+        if(c->target > size) c->target = size; //ARC target can't pass size
+        while(c->current_cache_size > c->max_cache_size) { //evict until frames fit
+            victim = c->policy->victim(c, 0);
+            remove_slot(c, partition_victim(c, c->slot_parts[victim], victim), 1); //from a partition that can spare it
+        }
+        pthread_mutex_unlock(&c->lock);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_tier2
+// Description  : Keep frames evicted from memory in a local file (must be
+//                called before init)
+//
+// Inputs       : path - the file, NULL for no second tier
+//                frames - frames the file holds, 0 for default
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_tier2(const char *path, uint32_t frames) {
+    free(cache.tier2_path);
+    cache.tier2_path = (path == NULL) ? NULL : strdup(path); //sets file
+    cache.tier2_frames = (frames == 0) ? CART_CACHE_TIER2_DEFAULT_FRAMES : frames; //sets size
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_shared
+// Description  : Share frames with every driver on the host through a
+//                shared memory segment (must be called before init). Only
+//                drivers of the same known generation share frames; with
+//                an unknown generation, as the CART driver sets at
+//                poweron, the segment only serves frames this process
+//                stored.
+//
+// Inputs       : name - the segment, as for shm_open, NULL for no sharing
+//                frames - frames the segment holds if this process creates
+//                         it, 0 for default
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_shared(const char *name, uint32_t frames) {
+    free(cache.shared_name);
+    cache.shared_name = (name == NULL) ? NULL : strdup(name); //sets segment
+    cache.shared_frames = (frames == 0) ? CART_CACHE_SHARED_DEFAULT_FRAMES : frames; //sets size
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_snapshot
+// Description  : Save the resident frames to a file on close, and warm the
+//                cache from it on init (must be called before init)
+//
+// Inputs       : path - snapshot file, NULL for none
+//                payloads - 1 to keep frame data, 0 to keep only keys
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_snapshot(const char *path, int payloads) {
+    free(cache.snapshot_path);
+    cache.snapshot_path = (path == NULL) ? NULL : strdup(path); //sets file
+    cache.snapshot_payloads = payloads; //sets what is kept
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_generation
+// Description  : Say which contents of the carts the cache mirrors (must be
+//                called before init). Frame data of a snapshot is only put
+//                back, and frames in shared memory only used, if they came
+//                from the same generation.
+//
+// Inputs       : generation - contents of the carts, 0 if unknown
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_generation(uint64_t generation) {
+    cache.generation = generation; //sets generation
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_partition
+// Description  : Give a partition a minimum of frames no other partition
+//                can evict, and a maximum it can't grow past. May be called
+//                while the cache runs; frames over a new maximum leave as
+//                the partition adds more.
+//
+// Inputs       : part - the partition
+//                min_frames - frames reserved
+//                max_frames - most frames, 0 for no limit
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_partition(int part, uint32_t min_frames, uint32_t max_frames) {
+    if(part < 0 || part >= CART_CACHE_MAX_PARTITIONS || (max_frames != 0 && min_frames > max_frames)) return(-1); //bad partition or quota
+    cache.partitions[part].configured = 1;
+    cache.partitions[part].min_frames = min_frames;
+    cache.partitions[part].max_frames = max_frames;
+    partition_reset_targets(); //split cache again
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_rebalance
+// Description  : Turn rebalancing of the partition targets on or off (may
+//                be called while the cache runs)
+//
+// Inputs       : enable - 1 to move frames toward the partition that would
+//                         gain most, 0 to keep quotas fixed
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_rebalance(int enable) {
+    cache.rebalance = enable; //sets rebalancing
+    partition_reset_targets(); //start from an even split
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_mrc
+// Description  : Sample reuse distances to estimate the miss ratio curve
+//                (must be called before init)
+//
+// Inputs       : enable - 1 to sample, 0 not to
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_mrc(int enable) {
+    cache.track_mrc = enable; //sets sampling
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_autotune
+// Description  : Resize the cache to the knee of the miss ratio curve as it
+//                runs (must be called before init). The size at init is the
+//                most the cache will grow to.
+//
+// Inputs       : enable - 1 to auto-tune, 0 not to
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_autotune(int enable) {
+    cache.autotune = enable; //sets auto-tuning
+    if(enable) cache.track_mrc = 1; //tuning needs the curve
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : note_access
+// Description  : Samples an access for the miss ratio curve, and auto-tunes
+//                the cache when a tune period has passed. Called without
+//                any shard lock, since tuning takes them all.
+//
+// Inputs       : key - index key of frame
+//                put - 1 for a put, 0 for a get
+// Outputs      : none
+
+void note_access(uint32_t key, int put) {
+    if(cache.track_mrc && mrc_record(&cache.mrc, key, put) && cache.autotune) autotune_cart_cache();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : autotune_cart_cache
+// Description  : Resizes the cache to the knee of the miss ratio curve
+//
+// Inputs       : none
+// Outputs      : none
+
+void autotune_cart_cache(void) {
+    int knee = cart_cache_mrc_knee(); //size past which frames buy little
+
+    if(knee == 0) return; //nothing sampled
+    if(knee > cache.capacity) knee = cache.capacity;
+    if(knee != cache.max_cache_size) {
+        logMessage(LOG_INFO_LEVEL, "Cache auto-tuned from %d to %d frames.", cache.max_cache_size, knee);
+        resize_cart_cache(knee);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_shards
+// Description  : Set the number of shards the cache is split into (must be
+//                called before init). Rounded up to a power of two.
+//
+// Inputs       : shards - number of shards
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_shards(uint32_t shards) {
+    uint32_t count = 1; //power of two
+
+    if(shards == 0 || shards > CART_CACHE_MAX_SHARDS) return(-1); //bad shard count
+    while(count < shards) count <<= 1;
+    cache.shard_count = count; //sets shard count
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Functions
+// Function     : set_cart_cache_hugepages
+// Description  : Ask for hugepages for the frame payloads (must be called
+//                before init). Falls back to normal pages if none are free.
+//
+// Inputs       : enable - 1 to use hugepages, 0 not to
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_hugepages(int enable) {
+    cache.use_hugepages = enable; //sets hugepage use
+    return(0);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : set_cart_cache_size
-// Description  : Set the size of the cache (must be called before init)
+// Function     : set_cart_cache_policy
+// Description  : Select the replacement policy (must be called before init)
 //
-// Inputs       : max_frames - the maximum number of items your cache can hold
+// Inputs       : name - LRU, CLOCK, 2Q or ARC
 // Outputs      : 0 if successful, -1 if failure
 
-int set_cart_cache_size(uint32_t max_frames) {
-    cache.max_cache_size = max_frames; //sets max cache size;
-    return(0); //successfully sets cache size
+int set_cart_cache_policy(const char *name) {
+    const cache_policy *policy = find_cart_cache_policy(name); //policy with name
+
+    if(policy == NULL) return(-1); //unknown policy
+    cache.policy = policy; //sets policy
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_pin_budget
+// Description  : Set how many frames can be pinned (must be called before
+//                init). Every shard gets that many slots beside its share
+//                of the cache size, so pinned frames never take room from
+//                other frames, however they hash.
+//
+// Inputs       : frames - most frames pinned at once
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_pin_budget(uint32_t frames) {
+    if(cache.shards != NULL) return(-1); //slots are allocated at init
+    cache.pin_budget = frames; //sets pin budget
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : set_cart_cache_admission
+// Description  : Turn the frequency admission filter on or off (must be
+//                called before init)
+//
+// Inputs       : enable - 1 to filter new frames, 0 to admit every frame
+// Outputs      : 0 if successful, -1 if failure
+
+int set_cart_cache_admission(int enable) {
+    cache.admission = enable; //sets admission filter
+    return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : init_cart_cache
-// Description  : Initialize the cache and note maximum frames
+// Description  : Initialize the cache, splitting the maximum frames over the
+//                shards. A shard never gets less than one frame.
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
 int init_cart_cache(void) {
-    int i, j; //iterating variables
+    int i; //iterating variable
     cache.max_cache_size = (cache.max_cache_size == 0) ? DEFAULT_CART_FRAME_CACHE_SIZE : cache.max_cache_size;
-    
-    for(i = 0; i < CART_MAX_CARTRIDGES; i++) { //iterate through carts
-        for(j = 0; j < CART_CARTRIDGE_SIZE; j++) //iterate through frames
-            cache.filled_cache_frames[i][j] = NULL; //set everything in cache to null
+    cache.policy = (cache.policy == NULL) ? find_cart_cache_policy(DEFAULT_CART_CACHE_POLICY) : cache.policy;
+    cache.shard_count = (cache.shard_count == 0) ? 1 : cache.shard_count;
+    while(cache.shard_count > 1 && cache.shard_count > cache.max_cache_size) cache.shard_count >>= 1; //every shard holds a frame
+    cache.capacity = cache.max_cache_size; //most the cache can grow to at runtime
+    partition_reset_targets(); //split size that is now known
+    if(cache.track_mrc && mrc_init(&cache.mrc) == -1) return(init_unwind(0)); //if allocation fails
+    if(cache.tier2_path != NULL && tier2_init(&cache.tier2, cache.tier2_path, cache.tier2_frames) == -1) return(init_unwind(0)); //if file can't be made
+    if(cache.shared_name != NULL && shared_attach(&cache.shared, cache.shared_name, cache.shared_frames, cache.generation) == -1) return(init_unwind(0)); //if segment can't be used
+
+    if(posix_memalign((void **)&cache.shards, CART_CACHE_LINE, sizeof(Cache) * cache.shard_count) != 0) { //shards on their own cache lines
+        cache.shards = NULL;
+        return(init_unwind(0));
+    }
+    memset(cache.shards, 0, sizeof(Cache) * cache.shard_count); //no shard set up yet
+    for(i = 0; i < cache.shard_count; i++) { //split frames evenly, first shards take remainder
+        if(shard_init(&cache.shards[i], cache.max_cache_size / cache.shard_count + (i < cache.max_cache_size % cache.shard_count)) == -1) return(init_unwind(i + 1)); //this shard is half set up
     }
-    
-    cache.current_cache_size = 0; //initially cache is empty
-    cache.head = NULL; //sets cache head to null
-    cache.tail = NULL; //sets cache tail to null
 
-    return(0);
+    return(load_cart_cache_snapshot()); //warm cache from last run
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_unwind
+// Description  : Releases what a failed init set up, so the cache is left
+//                as if never initialized
+//
+// Inputs       : shards - shards set up, in full or in part
+// Outputs      : -1
+
+int init_unwind(int shards) {
+    int i; //shard
+
+    for(i = 0; cache.shards != NULL && i < shards; i++) shard_close(&cache.shards[i]);
+    free(cache.shards);
+    cache.shards = NULL;
+    mrc_free(&cache.mrc);
+    tier2_close(&cache.tier2, cache.tier2_path);
+    shared_detach(&cache.shared);
+    return(-1);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -67,18 +1159,100 @@ int init_cart_cache(void) {
 // Outputs      : o if successful, -1 if failure
 
 int close_cart_cache(void) {
-    cache_node *current = cache.head; //current node
-    cache_node *prev; //previous node in list
+    int i; //iterating variable
+
+    if(cache.shards == NULL) return(0); //cache was never initialized
+    save_cart_cache_snapshot(); //keep resident frames for next run, a failure only loses the warm start
+    for(i = 0; i < cache.shard_count; i++) shard_close(&cache.shards[i]); //release every shard
+    mrc_free(&cache.mrc); //release sampler
+    tier2_close(&cache.tier2, cache.tier2_path); //remove second tier
+    shared_detach(&cache.shared); //segment stays for other processes
+    free(cache.warm_keys); //keys never prefetched
+    cache.warm_keys = NULL;
+    cache.warm_count = 0;
+    free(cache.shards);
+    cache.shards = NULL; //no shards left
+    cache.pinned = 0; //pins went with the shards
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_cache_stats
+// Description  : Adds up the counters of every shard. Counters are read
+//                without locks, so a running cache gives a close snapshot.
+//
+// Inputs       : stats - where to put the statistics
+// Outputs      : 0 if successful, -1 if cache is not initialized
+
+int cart_cache_stats(CacheStats *stats) {
+    int i, j; //shard and cart
+    cache_cart_stats *from, *to; //counters of shard, counters of stats
+    cache_partition_stats *part_from, *part_to; //counters of shard partition, counters of stats partition
 
-    while(current != NULL) { //go through every node in list to delete
-        prev = current->prev; // set prev node to the prev of current
-        delete_cart_cache(current->cart, current->frame); //delete current node 
-        current = prev; //set current to prev node
+    if(cache.shards == NULL) return(-1); //cache is not initialized
+    memset(stats, 0, sizeof(CacheStats));
+    stats->policy = cache.policy->name;
+    stats->max_cache_size = cache.max_cache_size;
+    stats->shard_count = cache.shard_count;
+    stats->pinned_frames = __atomic_load_n(&cache.pinned, __ATOMIC_RELAXED);
+    stats->pin_budget = cache.pin_budget;
+    for(i = 0; i < cache.shard_count; i++) { //add up every shard
+        stats->current_cache_size += cache.shards[i].current_cache_size;
+        for(j = 0; j < CART_MAX_CARTRIDGES; j++) { //add up every cart
+            from = &cache.shards[i].carts[j];
+            to = &stats->carts[j];
+            to->hits += __atomic_load_n(&from->hits, __ATOMIC_RELAXED);
+            to->misses += __atomic_load_n(&from->misses, __ATOMIC_RELAXED);
+            to->insertions += __atomic_load_n(&from->insertions, __ATOMIC_RELAXED);
+            to->evictions += __atomic_load_n(&from->evictions, __ATOMIC_RELAXED);
+            to->rejected += __atomic_load_n(&from->rejected, __ATOMIC_RELAXED);
+            to->prefetches += __atomic_load_n(&from->prefetches, __ATOMIC_RELAXED);
+            to->prefetch_hits += __atomic_load_n(&from->prefetch_hits, __ATOMIC_RELAXED);
+            to->prefetch_wasted += __atomic_load_n(&from->prefetch_wasted, __ATOMIC_RELAXED);
+        }
+        for(j = 0; j < CART_CACHE_MAX_PARTITIONS; j++) { //add up every partition
+            part_from = &cache.shards[i].parts[j];
+            part_to = &stats->partitions[j];
+            part_to->frames += part_from->frames;
+            part_to->hits += __atomic_load_n(&part_from->hits, __ATOMIC_RELAXED);
+            part_to->misses += __atomic_load_n(&part_from->misses, __ATOMIC_RELAXED);
+            part_to->evictions += __atomic_load_n(&part_from->evictions, __ATOMIC_RELAXED);
+            part_to->ghost_hits += __atomic_load_n(&part_from->ghost_hits, __ATOMIC_RELAXED);
+        }
+    }
+    for(j = 0; j < CART_CACHE_MAX_PARTITIONS; j++) { //targets are kept for the whole cache
+        stats->partition_targets[j] = __atomic_load_n(&cache.partitions[j].target, __ATOMIC_RELAXED);
+    }
+    for(j = 0; j < CART_MAX_CARTRIDGES; j++) { //totals over carts
+        stats->total.hits += stats->carts[j].hits;
+        stats->total.misses += stats->carts[j].misses;
+        stats->total.insertions += stats->carts[j].insertions;
+        stats->total.evictions += stats->carts[j].evictions;
+        stats->total.rejected += stats->carts[j].rejected;
+        stats->total.prefetches += stats->carts[j].prefetches;
+        stats->total.prefetch_hits += stats->carts[j].prefetch_hits;
+        stats->total.prefetch_wasted += stats->carts[j].prefetch_wasted;
+    }
+    stats->bytes_saved = stats->total.hits * CART_FRAME_SIZE; //each hit is a frame not read from the cart
+    stats->write_backs = 0; //cache is write-through, evictions never write back
+    if(cache.tier2.keys != NULL) { //second tier counters
+        pthread_mutex_lock(&cache.tier2.lock);
+        stats->tier2_frames = cache.tier2.frames;
+        stats->tier2_hits = cache.tier2.hits;
+        stats->tier2_misses = cache.tier2.misses;
+        stats->tier2_writes = cache.tier2.writes;
+        pthread_mutex_unlock(&cache.tier2.lock);
+        stats->bytes_saved += stats->tier2_hits * CART_FRAME_SIZE; //read from file, not from cart
+    }
+    if(cache.shared.segment != NULL) { //shared tier counters
+        stats->shared_frames = cache.shared.segment->sets * CART_CACHE_SHARED_WAYS;
+        stats->shared_hits = __atomic_load_n(&cache.shared.hits, __ATOMIC_RELAXED);
+        stats->shared_misses = __atomic_load_n(&cache.shared.misses, __ATOMIC_RELAXED);
+        stats->shared_stores = __atomic_load_n(&cache.shared.stores, __ATOMIC_RELAXED);
+        stats->bytes_saved += stats->shared_hits * CART_FRAME_SIZE; //read from shared memory, not from cart
     }
-   
-    cache.head = NULL; //set cache head to null
-    cache.tail = NULL; //set cache tail to null
-    
     return(0);
 }
 
@@ -93,72 +1267,386 @@ int close_cart_cache(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 int put_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf)  {
-    if(cache.max_cache_size <= 0) return(0); //if cache size is non-positive, cache is not used, therefore treat program as normal
-    
-    cache_node *node = cache.filled_cache_frames[cart][frm]; //get data from cache storage
-    char *charbuf = (char *) buf; //converts text buffer to string 
-    
-    if(node == NULL) { //if data not in cache
-        node = (cache_node *) malloc(sizeof(cache_node)); //create node of correct size 
-        memcpy(node->data, charbuf, CART_FRAME_SIZE); // copy data from charbuf into node
-        node->cart = cart; //set cart
-        node->frame = frm; //set frame
-        node->prev = NULL; //prev to null
-        node->next = NULL; //next to null
-        
-        if(cache.current_cache_size == 0) { //if cache is empty
-            cache.head = node; //make node head
-        } else if(cache.current_cache_size < cache.max_cache_size) { //if cache has room
-            node->next = cache.tail; //point node next to current tail
-            cache.tail->prev = node; //point tail prev to node
-        } else { //if cache has no room
-            delete_cart_cache(cache.head->cart, cache.head->frame); //delete top of cache
-            if(cache.current_cache_size == 0) { //if cache is empty
-                cache.head = node; //make node head
-            } else { //if not emptyy
-                node->next = cache.tail; //point node next tp current tail
-                cache.tail->prev = node; //point tail prev to node
-            }
-        }
-        
-        cache.tail = node; //set tail to node
-        cache.current_cache_size++; //increase current cache size
-        cache.filled_cache_frames[cart][frm] = node; //add node to the filled frames
-    } else { //if data is already in cache
-        if(cache.current_cache_size > 1 && (node != cache.tail)) { //if cache size is greather than 1 or node isnt at end
-            if(node == cache.head) { // if node is head
-                cache.head = cache.head->prev; //make the head's previous node the new head
-                cache.head->next->next = cache.tail; //set node's (old head) next to the tail
-                cache.tail->prev = cache.head->next; //set the tail's prev to node (old head)
-                cache.tail = cache.head->next; //set the tail to node (old head)
-                cache.tail->prev = NULL; //tail prev is null
-                cache.head->next = NULL; //head next is null
-            } else { //if node is somewhere else in the cache
-                node->prev->next = node->next; //set the node prev next to node next
-                node->next->prev = node->prev; //set the node next prev to node prev
-                node->next = cache.tail; //set node next to tail
-                cache.tail->prev = node; //set tail prev to node
-                node->prev = NULL; //set node prev to null
-                cache.tail = node; //make node the tail
-            }
+    return(put_cart_cache_part(cart, frm, buf, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : put_cart_cache_part
+// Description  : Put an object into the frame cache, charging a new slot to
+//                a partition. A frame already cached stays charged to the
+//                partition that added it.
+//
+// Inputs       : cart - the cartridge number of the frame to cache
+//                frm - the frame number of the frame to cache
+//                buf - the buffer to insert into the cache
+//                part - the partition
+// Outputs      : 0 if successful, -1 if failure
+
+int put_cart_cache_part(CartridgeIndex cart, CartFrameIndex frm, void *buf, int part)  {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+
+    if(part < 0 || part >= CART_CACHE_MAX_PARTITIONS) return(-1); //no such partition
+    if(cache.shards == NULL) return(0); //if cache is not used, treat program as normal
+    c = shard_of(key);
+    if(c->nodes == NULL) return(0); //if cache is not used, treat program as normal
+    note_access(key, 1);
+    shared_store(&cache.shared, key, buf); //other processes may use it, even if it isn't admitted here
+
+    pthread_mutex_lock(&c->lock);
+    shard_put(c, key, part, buf);
+    pthread_mutex_unlock(&c->lock);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_cart_cache
+// Description  : Put a frame read ahead of demand into the cache. It is not
+//                an access, so the miss ratio curve doesn't see it, and it
+//                is marked so its first use (or eviction unused) is counted.
+//
+// Inputs       : cart - the cartridge number of the frame to cache
+//                frm - the frame number of the frame to cache
+//                buf - the frame read from the cart
+// Outputs      : 0 if successful, -1 if failure
+
+int prefetch_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+    return(prefetch_cart_cache_part(cart, frm, buf, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_cart_cache_part
+// Description  : Put a frame read ahead of demand into the cache, as
+//                prefetch_cart_cache does, charging it to a partition
+//
+// Inputs       : cart - the cartridge number of the frame to cache
+//                frm - the frame number of the frame to cache
+//                buf - the frame read from the cart
+//                part - the partition
+// Outputs      : 0 if successful, -1 if failure
+
+int prefetch_cart_cache_part(CartridgeIndex cart, CartFrameIndex frm, void *buf, int part) {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+    int32_t slot; //slot of frame
+
+    if(part < 0 || part >= CART_CACHE_MAX_PARTITIONS) return(-1); //no such partition
+    if(cache.shards == NULL) return(-1); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(-1); //cache is not used
+    shared_store(&cache.shared, key, buf); //frame came from the cart
+
+    pthread_mutex_lock(&c->lock);
+    if(index_find(&c->filled_cache_frames, key) == CART_CACHE_NONE) { //cached copy is as new, leave it
+        shard_put(c, key, part, buf);
+        slot = index_find(&c->filled_cache_frames, key); //may not be admitted
+        if(slot != CART_CACHE_NONE) {
+            __atomic_fetch_or(&c->nodes[slot].flags, CART_CACHE_SLOT_PREFETCHED, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&cart_counters(c, key)->prefetches, 1, __ATOMIC_RELAXED);
         }
-        memcpy(node->data, charbuf, CART_FRAME_SIZE); //copy new data from buf into node
     }
+    pthread_mutex_unlock(&c->lock);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : peek_cart_cache
+// Description  : Check whether a frame is cached, without counting a hit or
+//                miss and without the policy seeing a use
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+// Outputs      : 1 if cached, 0 if not
+
+int peek_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+
+    if(cache.shards == NULL) return(0); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(0); //cache is not used
+    return(index_find(&c->filled_cache_frames, key) != CART_CACHE_NONE); //index is safe to read without the lock
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserve_cart_cache
+// Description  : Reserve the slot of a frame so the caller can build the
+//                frame in place and send it straight from the cache, with
+//                no copy in or out. The shard stays locked until
+//                commit_cart_cache, so no other cache call may be made for
+//                that shard in between.
+//
+// Inputs       : cart - the cartridge number of the frame to cache
+//                frm - the frame number of the frame to cache
+//                valid - NULL if the whole frame will be written, else set
+//                        to 1 if the slot holds the current frame, 0 if the
+//                        caller must fill it from the cart
+// Outputs      : CART_FRAME_SIZE bytes of the slot, NULL if the frame isn't
+//                cached (caller uses its own buffer, nothing to commit)
+
+void * reserve_cart_cache(CartridgeIndex cart, CartFrameIndex frm, int *valid) {
+    return(reserve_cart_cache_part(cart, frm, valid, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserve_cart_cache_part
+// Description  : Reserve the slot of a frame as reserve_cart_cache does,
+//                charging a new slot to a partition
+//
+// Inputs       : cart - the cartridge number of the frame to cache
+//                frm - the frame number of the frame to cache
+//                valid - NULL if the whole frame will be written, else set
+//                        to 1 if the slot holds the current frame, 0 if the
+//                        caller must fill it from the cart
+//                part - the partition
+// Outputs      : CART_FRAME_SIZE bytes of the slot, NULL if the frame isn't
+//                cached (caller uses its own buffer, nothing to commit)
+
+void * reserve_cart_cache_part(CartridgeIndex cart, CartFrameIndex frm, int *valid, int part) {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+    int32_t slot; //slot reserved
+
+    if(part < 0 || part >= CART_CACHE_MAX_PARTITIONS) return(NULL); //no such partition
+    if(cache.shards == NULL) return(NULL); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(NULL); //cache is not used
+    note_access(key, valid == NULL); //a merge reads the frame first
+
+    pthread_mutex_lock(&c->lock);
+    slot = shard_reserve(c, key, part, valid);
+    if(slot == CART_CACHE_NONE) { //frame not admitted
+        pthread_mutex_unlock(&c->lock);
+        return(NULL);
+    }
+    return(slot_data(c, slot)); //shard stays locked until commit
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : commit_cart_cache
+// Description  : Finish a reservation and unlock its shard. A frame that
+//                could not be sent to the cart is dropped, since the slot
+//                no longer matches the cart.
+//
+// Inputs       : cart - the cartridge number of the reserved frame
+//                frm - the frame number of the reserved frame
+//                keep - 1 to keep the frame, 0 to drop it
+// Outputs      : 0 if successful, -1 if failure
 
+int commit_cart_cache(CartridgeIndex cart, CartFrameIndex frm, int keep) {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c = shard_of(key); //shard of frame, locked by reserve
+    int32_t slot = index_find(&c->filled_cache_frames, key); //slot reserved
+
+    if(slot == CART_CACHE_NONE) { //no reservation
+        pthread_mutex_unlock(&c->lock);
+        return(-1);
+    }
+    if(keep) {
+        shared_store(&cache.shared, key, slot_data(c, slot)); //frame is on cart, other processes may use it
+        slot_write_end(c, slot); //frame is whole, readers may copy it
+    } else {
+        shared_drop(&cache.shared, key); //cart may hold part of the write
+        remove_slot(c, slot, 0); //frame isn't on cart, forget it
+    }
+    pthread_mutex_unlock(&c->lock);
     return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : get_cart_cache
-// Description  : Get an frame from the cache (and return it)
+// Description  : Get an frame from the cache (and return it). The pointer
+//                is only good until the next put or delete of that shard,
+//                so threads should use get_cart_cache_copy instead.
 //
 // Inputs       : cart - the cartridge number of the cartridge to find
 //                frm - the  number of the frame to find
 // Outputs      : pointer to cached frame or NULL if not found
 
 void * get_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
-    return(cache.filled_cache_frames[cart][frm]); //get that in cache (NULL if no data)
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+    int32_t slot; //slot in cache
+    char frame[CART_FRAME_SIZE]; //frame read back from second tier or shared memory
+
+    if(cache.shards == NULL) return(NULL); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(NULL); //cache is not used
+    note_access(key, 0);
+
+    pthread_mutex_lock(&c->lock);
+    slot = shard_get(c, key, 0);
+    if(slot == CART_CACHE_NONE && (tier2_load(&cache.tier2, key, frame) == 0 || shared_load(&cache.shared, key, frame) == 0)) { //if second tier or shared memory has frame, bring it back
+        shard_put(c, key, 0, frame);
+        slot = index_find(&c->filled_cache_frames, key); //may not be admitted
+    }
+    pthread_mutex_unlock(&c->lock);
+    return((slot == CART_CACHE_NONE) ? NULL : slot_data(c, slot)); //get data in cache
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_cart_cache_copy
+// Description  : Copy a frame out of the cache. Hits under CLOCK copy
+//                without the shard lock; everything else takes it.
+//
+// Inputs       : cart - the cartridge number of the cartridge to find
+//                frm - the  number of the frame to find
+//                buf - CART_FRAME_SIZE bytes to copy the frame into
+// Outputs      : 0 if found, -1 if not found
+
+int get_cart_cache_copy(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+    return(get_cart_cache_copy_part(cart, frm, buf, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : get_cart_cache_copy_part
+// Description  : Copy a frame out of the cache as get_cart_cache_copy does.
+//                A hit counts for the partition that added the frame; a
+//                miss, and a frame brought back from a lower tier, for the
+//                partition asking.
+//
+// Inputs       : cart - the cartridge number of the cartridge to find
+//                frm - the  number of the frame to find
+//                buf - CART_FRAME_SIZE bytes to copy the frame into
+//                part - the partition asking
+// Outputs      : 0 if found, -1 if not found
+
+int get_cart_cache_copy_part(CartridgeIndex cart, CartFrameIndex frm, void *buf, int part) {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+    int32_t slot; //slot in cache
+
+    if(part < 0 || part >= CART_CACHE_MAX_PARTITIONS) return(-1); //no such partition
+    if(cache.shards == NULL) return(-1); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(-1); //cache is not used
+    note_access(key, 0);
+    if(shard_get_lockless(c, key, buf) == 0) return(0); //hit without the lock
+
+    pthread_mutex_lock(&c->lock);
+    slot = shard_get(c, key, part);
+    if(slot != CART_CACHE_NONE) { //copy before slot can be reused
+        memcpy(buf, slot_data(c, slot), CART_FRAME_SIZE);
+    } else if(tier2_load(&cache.tier2, key, buf) == 0 || shared_load(&cache.shared, key, buf) == 0) { //if second tier or shared memory has frame, bring it back
+        shard_put(c, key, part, buf);
+        slot = 0; //found
+    }
+    pthread_mutex_unlock(&c->lock);
+    return((slot == CART_CACHE_NONE) ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pin_cart_cache
+// Description  : Pin a frame so it stays cached until unpinned or deleted.
+//                A cached frame leaves the policy's lists; a frame not
+//                cached is put in a slot of the pin budget, evicting
+//                nothing. Writes and gets of a pinned frame work as usual.
+//
+// Inputs       : cart - the cartridge number of the frame to pin
+//                frm - the frame number of the frame to pin
+//                buf - the frame, used if it isn't cached; NULL if it must be
+// Outputs      : 0 if successful, -1 if failure (budget used up, or frame
+//                not cached and no data given)
+
+int pin_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *buf) {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+    int32_t slot; //slot of frame
+
+    if(cache.shards == NULL) return(-1); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(-1); //cache is not used
+
+    pthread_mutex_lock(&c->lock);
+    slot = index_find(&c->filled_cache_frames, key);
+    if(slot != CART_CACHE_NONE && (__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PINNED)) { //already pinned
+        pthread_mutex_unlock(&c->lock);
+        return(0);
+    }
+    if(slot == CART_CACHE_NONE && buf == NULL) { //nothing to pin
+        pthread_mutex_unlock(&c->lock);
+        return(-1);
+    }
+    if(__atomic_add_fetch(&cache.pinned, 1, __ATOMIC_RELAXED) > cache.pin_budget) { //budget used up
+        __atomic_fetch_sub(&cache.pinned, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&c->lock);
+        return(-1);
+    }
+
+    if(slot == CART_CACHE_NONE) { //frame gets a slot of its own, one is always free within the budget
+        tier2_drop(&cache.tier2, key); //second tier copy is older
+        slot = c->free_nodes; //take unused slot
+        c->free_nodes = c->nodes[slot].next; //remove it from free list
+        slot_write_begin(c, slot);
+        __atomic_store_n(&c->nodes[slot].cart, CART_CACHE_KEY_CART(key), __ATOMIC_RELAXED); //set cart, lockless readers may look
+        __atomic_store_n(&c->nodes[slot].frame, CART_CACHE_KEY_FRAME(key), __ATOMIC_RELAXED); //set frame
+        __atomic_store_n(&c->nodes[slot].flags, CART_CACHE_SLOT_USED | CART_CACHE_SLOT_PINNED, __ATOMIC_RELAXED); //slot holds a pinned frame
+        __atomic_store_n(&c->slot_parts[slot], 0, __ATOMIC_RELAXED); //unpinned into the default partition
+        c->nodes[slot].next = CART_CACHE_NONE; //never on a list
+        c->nodes[slot].prev = CART_CACHE_NONE; //never on a list
+        memcpy(slot_data(c, slot), buf, CART_FRAME_SIZE); //copy frame into slot
+        index_insert(&c->filled_cache_frames, key, slot); //add slot to the filled frames, readers wait for even sequence
+        slot_write_end(c, slot);
+        __atomic_fetch_add(&cart_counters(c, key)->insertions, 1, __ATOMIC_RELAXED);
+    } else { //cached frame leaves the policy, so it is never a victim
+        c->policy->remove(c, slot, 0);
+        partition_remove(c, slot, 0);
+        c->current_cache_size--; //its room goes back to other frames
+        __atomic_fetch_or(&c->nodes[slot].flags, CART_CACHE_SLOT_PINNED, __ATOMIC_RELAXED);
+    }
+    c->pinned++;
+    pthread_mutex_unlock(&c->lock);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unpin_cart_cache
+// Description  : Give a pinned frame back to the replacement policy, as if
+//                it were just added, evicting another frame if the cache is
+//                full
+//
+// Inputs       : cart - the cartridge number of the frame to unpin
+//                frm - the frame number of the frame to unpin
+// Outputs      : 0 if successful, -1 if frame isn't pinned
+
+int unpin_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
+    uint32_t key = CART_CACHE_KEY(cart, frm); //index key of frame
+    Cache *c; //shard of frame
+    int32_t slot; //slot of frame
+
+    if(cache.shards == NULL) return(-1); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(-1); //cache is not used
+
+    pthread_mutex_lock(&c->lock);
+    slot = index_find(&c->filled_cache_frames, key);
+    if(slot == CART_CACHE_NONE || !(__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & CART_CACHE_SLOT_PINNED)) { //not pinned
+        pthread_mutex_unlock(&c->lock);
+        return(-1);
+    }
+    if(c->current_cache_size >= c->max_cache_size || partition_full(c, c->slot_parts[slot])) { //make room as for a new frame
+        remove_slot(c, partition_victim(c, c->slot_parts[slot], c->policy->victim(c, key)), 1);
+    }
+    __atomic_fetch_and(&c->nodes[slot].flags, ~CART_CACHE_SLOT_PINNED, __ATOMIC_RELAXED);
+    c->pinned--;
+    __atomic_fetch_sub(&cache.pinned, 1, __ATOMIC_RELAXED);
+    c->current_cache_size++;
+    partition_insert(c, key, c->slot_parts[slot], slot); //back on the partition it was pinned from
+    c->policy->insert(c, slot); //policy places slot
+    pthread_mutex_unlock(&c->lock);
+    return(0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -171,34 +1659,21 @@ void * get_cart_cache(CartridgeIndex cart, CartFrameIndex frm) {
 // Outputs      : 0 if successfully delete; -1 if failed.
 
 int delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk) {
-    cache_node *delete = cache.filled_cache_frames[cart][blk]; //gets node to delete
-    
-    if(delete == NULL) { //if node to delete is NULL
-        return(-1); //cannot delete
-    } else { //if there exists a node to delete
-        if(cache.current_cache_size > 1) { //if there is more than one node in cache
-            if(delete == cache.head) { //if node to delete is head
-                cache.head = cache.head->prev; //set new head to head prev
-                cache.head->next->prev = NULL; //set node to delete prev to null
-                cache.head->next = NULL; //set head next to null 
-            } else if(delete == cache.tail) { //if node to delete is tail
-                cache.tail = cache.tail->next; //set new tail to tail next
-                cache.tail->prev->next = NULL; //set node to delete next to null
-                cache.tail->prev = NULL; //set tail prev to null
-            } else { //if node to delete is anywhere else in cache
-                delete->prev->next = delete->next; //set delete prev next to delete next
-                delete->next->prev = delete->prev; //set delete next prev to delete prev
-                delete->prev = NULL; //set delete prev to null
-                delete->next = NULL; //set delete next to null
-            }
-        } 
-        free(delete); //free the node to delete from memory
-        delete = NULL; //set delete pointer to null
-        cache.filled_cache_frames[cart][blk] = NULL; //remove the node from cache
-        cache.current_cache_size--; //decrement the current size of cache
-    }
+    uint32_t key = CART_CACHE_KEY(cart, blk); //index key of frame
+    Cache *c; //shard of frame
+    int32_t slot; //slot to delete
 
-    return(0);
+    if(cache.shards == NULL) return(-1); //cache is not used
+    c = shard_of(key);
+    if(c->nodes == NULL) return(-1); //cache is not used
+
+    pthread_mutex_lock(&c->lock);
+    slot = index_find(&c->filled_cache_frames, key); //gets slot to delete
+    if(slot != CART_CACHE_NONE) remove_slot(c, slot, 0); //take slot out of cache
+    tier2_drop(&cache.tier2, key); //and out of second tier
+    shared_drop(&cache.shared, key); //and out of shared memory, the frame is freed or written around
+    pthread_mutex_unlock(&c->lock);
+    return((slot == CART_CACHE_NONE) ? -1 : 0); //cannot delete a frame that isn't cached
 }
 
 //
@@ -213,8 +1688,23 @@ int delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk) {
 // Outputs      : 0 if successful, -1 if failure
 
 int cartCacheUnitTest(void) {
-    int start, close, i, r_cart, r_frame, op, put; //temp variables 
-    cache_node *read; //read in node for cache
+    int start, close, i, r_cart, r_frame, op, put, p, round, s; //temp variables
+    int saved_size = cache.max_cache_size; //cache size to restore after test
+    int saved_shards = cache.shard_count; //shard count to restore after test
+    const cache_policy *saved_policy = cache.policy; //policy to restore after test
+    int saved_admission = cache.admission; //admission filter to restore after test
+    int saved_mrc = cache.track_mrc; //sampling to restore after test
+    char *saved_tier2; //second tier to restore after test
+    int32_t saved_tier2_frames; //size of second tier to restore after test
+    char *saved_snapshot = cache.snapshot_path; //snapshot to restore after test
+    int saved_payloads = cache.snapshot_payloads; //snapshot data to restore after test
+    uint64_t saved_generation = cache.generation; //generation to restore after test
+    char *saved_shared = cache.shared_name; //shared segment to restore after test
+    int32_t saved_shared_frames = cache.shared_frames; //size of shared segment to restore after test
+    uint32_t keys[8]; //keys of snapshot to prefetch
+    CacheStats stats; //counters of prefetch test
+    char *read; //read in frame from cache
+    char copy[CART_FRAME_SIZE]; //frame copied out of cache
     char *data[5][5] = { //sample data to test cache with
         {"hello", "how", "are", "you", "today"},
         {"im", "good", "what", "about", "yourself"},
@@ -222,29 +1712,398 @@ int cartCacheUnitTest(void) {
         {"welcome", "to", "the", "big", "jungle"},
         {"i", "was", "like", "hey", "whats"}
     };
+    char frames[5][5][CART_FRAME_SIZE]; //sample data padded to whole frames
+
+    cache.snapshot_path = NULL; //test caches never touch a configured snapshot
+    cache.shared_name = NULL; //or a configured shared segment
+    memset(frames, 0, sizeof(frames));
+    for(r_cart = 0; r_cart < 5; r_cart++) { //pad each sample
+        for(r_frame = 0; r_frame < 5; r_frame++) strcpy(frames[r_cart][r_frame], data[r_cart][r_frame]);
+    }
 
-    start = init_cart_cache(); //initialize cache
-    if(start == -1) return(-1); //if init fails, return fail
-    
-    for(i = 0; i < 10000; i++) { //10000 tests
-        op = rand() % 2; //gets random operation from 0-1; 0 = get, 1 = put
-        r_cart = rand() % 5; //gets random cart from 0-4
-        r_frame = rand() % 5; //gets random frame from 0-4
-        
-        if(op == 0) { //if op is 0, try get command
-            read = get_cart_cache(r_cart, r_frame); //get random data from cache
-            if(read != NULL) { //if data exists
-                if(strcmp(read->data, data[r_cart][r_frame])) return(-1); //compare cache with sample data, fail if data is different
+    for(p = 0; cart_cache_policies[p].name != NULL; p++) { //test every policy
+        for(round = 0; round < 2; round++) { //at configured size, then small and sharded enough to evict
+            cache.policy = &cart_cache_policies[p];
+            cache.max_cache_size = (round == 0) ? saved_size : 7;
+            cache.shard_count = (round == 0) ? saved_shards : 4;
+            cache.admission = 0; //every put must be admitted for checks below
+            start = init_cart_cache(); //initialize cache
+            if(start == -1) return(-1); //if init fails, return fail
+
+            for(i = 0; i < 10000; i++) { //10000 tests
+                op = rand() % 3; //gets random operation from 0-2; 0 = get, 1 = put, 2 = delete
+                r_cart = rand() % 5; //gets random cart from 0-4
+                r_frame = rand() % 5; //gets random frame from 0-4
+
+                if(op == 0) { //if op is 0, try get command
+                    read = get_cart_cache(r_cart, r_frame); //get random data from cache
+                    if(read != NULL) { //if data exists
+                        if(strcmp(read, data[r_cart][r_frame])) return(-1); //compare cache with sample data, fail if data is different
+                    }
+                    if(get_cart_cache_copy(r_cart, r_frame, copy) == 0) { //copy, lockless for CLOCK
+                        if(strcmp(copy, data[r_cart][r_frame])) return(-1); //copy must match sample data
+                    }
+                } else if(op == 1) { //if op is 1, try put command
+                    put = put_cart_cache(r_cart, r_frame, frames[r_cart][r_frame]); //insert data into frame
+                    if(put == -1) return(-1); //if put fails, return fail
+                    if(get_cart_cache(r_cart, r_frame) == NULL) return(-1); //frame just put must be there
+                } else { //if op is 2, try delete command
+                    delete_cart_cache(r_cart, r_frame); //remove frame if it is cached
+                    if(get_cart_cache(r_cart, r_frame) != NULL) return(-1); //frame must be gone
+                }
+                for(s = 0; s < cache.shard_count; s++) { //no shard may ever overfill
+                    if(cache.shards[s].current_cache_size > cache.shards[s].max_cache_size) return(-1);
+                }
+            }
+
+            close = close_cart_cache(); //close cache
+            if(close == -1) return(-1); //if close fails, return -1
+        }
+    }
+
+    for(p = 0; cart_cache_policies[p].name != NULL; p++) { //a scan must not flush hot frames from any policy
+        cache.policy = &cart_cache_policies[p];
+        cache.max_cache_size = 8;
+        cache.shard_count = 1;
+        cache.admission = 1;
+        if(init_cart_cache() == -1) return(-1);
+        for(round = 0; round < 4; round++) { //use 8 hot frames a few times
+            for(r_frame = 0; r_frame < 8; r_frame++) {
+                if(get_cart_cache(0, r_frame) == NULL && put_cart_cache(0, r_frame, frames[0][r_frame % 5]) == -1) return(-1);
             }
-        } else { //if op is 1, try put command
-            put = put_cart_cache(r_cart, r_frame, data[r_cart][r_frame]); //insert data into frame
-            if(put == -1) return(-1); //if put fails, return fail
         }
+        for(r_frame = 0; r_frame < 64; r_frame++) { //scan 64 frames once
+            if(get_cart_cache(1, r_frame) == NULL && put_cart_cache(1, r_frame, frames[1][r_frame % 5]) == -1) return(-1);
+        }
+        for(r_frame = 0; r_frame < 8; r_frame++) { //hot frames must survive
+            if(get_cart_cache(0, r_frame) == NULL) return(-1);
+        }
+        if(close_cart_cache() == -1) return(-1);
+    }
+
+    cache.policy = &cart_cache_policies[0]; //a loop over 200 frames needs a cache of about 200
+    cache.max_cache_size = 512;
+    cache.shard_count = 4;
+    cache.admission = 0;
+    cache.track_mrc = 1;
+    if(init_cart_cache() == -1) return(-1);
+    for(round = 0; round < 20; round++) { //loop over 200 frames on 4 carts
+        for(i = 0; i < 200; i++) {
+            if(get_cart_cache(i % 4, i) == NULL && put_cart_cache(i % 4, i, frames[0][0]) == -1) return(-1);
+        }
+    }
+    if(cart_cache_miss_ratio(64) < 0.9 || cart_cache_miss_ratio(512) > 0.2) return(-1); //small cache always misses, big one only cold
+    if(cart_cache_mrc_knee() < 128 || cart_cache_mrc_knee() > 320) return(-1); //knee is near the loop
+    if(set_cart_cache_size(100) == -1 || cache.max_cache_size != 100) return(-1); //shrink while running
+    for(s = 0; s < cache.shard_count; s++) {
+        if(cache.shards[s].current_cache_size > cache.shards[s].max_cache_size) return(-1);
+    }
+    if(set_cart_cache_size(1000) == -1 || cache.max_cache_size != 512) return(-1); //grow back only to size at init
+    if(close_cart_cache() == -1) return(-1);
+    cache.track_mrc = saved_mrc;
+
+    cache.max_cache_size = 4; //frames evicted from memory come back from second tier
+    cache.shard_count = 1;
+    saved_tier2 = cache.tier2_path; //configured tier is put back after
+    saved_tier2_frames = cache.tier2_frames;
+    cache.tier2_path = NULL;
+    set_cart_cache_tier2("cart_cache_unit.tier2", 16);
+    if(init_cart_cache() == -1) return(-1);
+    for(i = 0; i < 10; i++) { //put 10 frames, 6 go to second tier
+        if(put_cart_cache(i % 5, i, frames[i % 5][i % 5]) == -1) return(-1);
+    }
+    for(i = 0; i < 10; i++) { //every frame is still found
+        if(get_cart_cache_copy(i % 5, i, copy) == -1 || strcmp(copy, data[i % 5][i % 5])) return(-1);
+    }
+    delete_cart_cache(0, 0); //deleted frame is gone from both tiers
+    delete_cart_cache(1, 1);
+    if(get_cart_cache_copy(0, 0, copy) == 0 || get_cart_cache_copy(1, 1, copy) == 0) return(-1);
+    if(close_cart_cache() == -1 || init_cart_cache() == -1) return(-1);
+    for(i = 0; i < 6; i++) { //put 6 frames, 2 go to second tier
+        if(put_cart_cache(3, i, frames[3][i % 5]) == -1) return(-1);
+    }
+    for(i = 0; peek_cart_cache(3, i); i++); //a frame only the second tier holds
+    if(reserve_cart_cache(3, i, &put) == NULL || !put) return(-1);
+    commit_cart_cache(3, i, 1);
+    if(cart_cache_stats(&stats) == -1 || stats.total.hits != 0 || stats.tier2_hits != 1 || stats.bytes_saved != CART_FRAME_SIZE) return(-1); //saved once
+    if(close_cart_cache() == -1) return(-1);
+    set_cart_cache_tier2(NULL, 0);
+    cache.tier2_path = saved_tier2;
+    cache.tier2_frames = saved_tier2_frames;
+
+    shm_unlink("/cart_cache_unit"); //frames left by an aborted test
+    set_cart_cache_shared("/cart_cache_unit", 64);
+    set_cart_cache_generation(1);
+    if(init_cart_cache() == -1) return(-1);
+    for(i = 0; i < 5; i++) { //frames fetched by one driver
+        if(put_cart_cache(2, i, frames[2][i]) == -1) return(-1);
+    }
+    if(close_cart_cache() == -1 || init_cart_cache() == -1) return(-1); //next driver starts with an empty memory cache
+    for(i = 0; i < 5; i++) { //and finds them in shared memory
+        if(get_cart_cache_copy(2, i, copy) == -1 || strcmp(copy, data[2][i])) return(-1);
+    }
+    if(cart_cache_stats(&stats) == -1 || stats.shared_hits != 5 || stats.shared_frames != 64) return(-1);
+    delete_cart_cache(2, 0); //deleted frame is gone for every driver
+    if(close_cart_cache() == -1 || init_cart_cache() == -1) return(-1);
+    if(get_cart_cache_copy(2, 0, copy) == 0 || get_cart_cache_copy(2, 1, copy) == -1) return(-1);
+    if(close_cart_cache() == -1) return(-1);
+    set_cart_cache_generation(2); //carts reformatted, frames of before are stale
+    if(init_cart_cache() == -1 || get_cart_cache_copy(2, 2, copy) == 0) return(-1);
+    if(close_cart_cache() == -1) return(-1);
+    set_cart_cache_generation(0); //unknown generation, frames of any driver before are stale
+    if(init_cart_cache() == -1 || get_cart_cache_copy(2, 3, copy) == 0) return(-1);
+    if(close_cart_cache() == -1) return(-1);
+    shm_unlink("/cart_cache_unit");
+    set_cart_cache_shared(NULL, 0);
+
+    for(p = 0; cart_cache_policies[p].name != NULL; p++) { //frames built in place in a reserved slot
+        cache.policy = &cart_cache_policies[p];
+        cache.max_cache_size = 4;
+        cache.shard_count = 1;
+        if(init_cart_cache() == -1) return(-1);
+        for(i = 0; i < 6; i++) { //whole frames, the first two get evicted
+            if((read = reserve_cart_cache(0, i, NULL)) == NULL) return(-1);
+            memcpy(read, frames[0][i % 5], CART_FRAME_SIZE);
+            if(commit_cart_cache(0, i, 1) == -1) return(-1);
+        }
+        if((read = reserve_cart_cache(0, 5, &put)) == NULL || !put || strcmp(read, data[0][0])) return(-1); //cached frame is valid
+        strcpy(read, data[1][0]); //change part of it in place
+        if(commit_cart_cache(0, 5, 1) == -1 || get_cart_cache_copy(0, 5, copy) == -1 || strcmp(copy, data[1][0])) return(-1);
+        if((read = reserve_cart_cache(1, 0, &put)) == NULL || put) return(-1); //new frame must be filled by caller
+        if(commit_cart_cache(1, 0, 0) == -1 || get_cart_cache(1, 0) != NULL) return(-1); //dropped frame is gone
+        if(cache.shards[0].current_cache_size > 4) return(-1);
+        if(close_cart_cache() == -1) return(-1);
+    }
+
+    cache.policy = &cart_cache_policies[0]; //prefetched frames are counted once when used, or when left unused
+    cache.max_cache_size = 4;
+    cache.shard_count = 1;
+    if(init_cart_cache() == -1) return(-1);
+    if(prefetch_cart_cache(0, 0, frames[0][0]) == -1 || prefetch_cart_cache(0, 1, frames[0][1]) == -1) return(-1);
+    if(!peek_cart_cache(0, 0) || peek_cart_cache(0, 2)) return(-1);
+    if(get_cart_cache(0, 0) == NULL || get_cart_cache(0, 0) == NULL) return(-1); //used twice, counted once
+    delete_cart_cache(0, 1); //left unused
+    if(cart_cache_stats(&stats) == -1 || stats.total.prefetches != 2 || stats.total.prefetch_hits != 1 || stats.total.prefetch_wasted != 1) return(-1);
+    if(close_cart_cache() == -1) return(-1);
+
+    for(p = 0; cart_cache_policies[p].name != NULL; p++) { //a snapshot brings back frames and their order
+        cache.policy = &cart_cache_policies[p];
+        cache.max_cache_size = 4;
+        cache.shard_count = 1;
+        set_cart_cache_snapshot("cart_cache_unit.snapshot", 1);
+        set_cart_cache_generation(1);
+        if(init_cart_cache() == -1) return(-1);
+        for(i = 4; i > 0; i--) { //put 4 frames, oldest on the highest cart
+            if(put_cart_cache(i, i, frames[i][i]) == -1) return(-1);
+        }
+        if(close_cart_cache() == -1) return(-1);
+        if(init_cart_cache() == -1) return(-1); //same generation, data comes back
+        if(cache.policy->slot_lists != 0) { //recency comes back too, oldest leaves first
+            if(put_cart_cache(0, 0, frames[0][0]) == -1 || get_cart_cache(4, 4) != NULL) return(-1);
+        }
+        for(i = 1; i < 4; i++) {
+            if(get_cart_cache_copy(i, i, copy) == -1 || strcmp(copy, data[i][i])) return(-1);
+        }
+        if(close_cart_cache() == -1) return(-1);
+        set_cart_cache_generation(2); //carts changed, only keys come back
+        if(init_cart_cache() == -1) return(-1);
+        if(get_cart_cache(1, 1) != NULL || cart_cache_warm_keys(keys, 8) != 4) return(-1);
+        for(i = 1; i < 4; i++) {
+            if(keys[i - 1] >= keys[i]) return(-1); //keys are in cart order
+        }
+        if(close_cart_cache() == -1) return(-1);
+        remove("cart_cache_unit.snapshot");
+        set_cart_cache_snapshot(NULL, 0);
+    }
+    cache.snapshot_path = saved_snapshot;
+    cache.snapshot_payloads = saved_payloads;
+    cache.shared_name = saved_shared;
+    cache.shared_frames = saved_shared_frames;
+    cache.generation = saved_generation;
+
+    for(p = 0; cart_cache_policies[p].name != NULL; p++) { //a scan can't take a partition's minimum, a capped partition keeps to its maximum
+        cache.policy = &cart_cache_policies[p];
+        cache.max_cache_size = 8;
+        cache.shard_count = 1;
+        if(set_cart_cache_partition(1, 4, 0) == -1 || set_cart_cache_partition(2, 0, 2) == -1) return(-1);
+        if(init_cart_cache() == -1) return(-1);
+        if(put_cart_cache_part(1, 0, frames[1][0], CART_CACHE_MAX_PARTITIONS) != -1) return(-1); //no such partition
+        for(i = 0; i < 4; i++) { //cart 1 is partition 1, cart 2 partition 2, the rest stay in 0
+            if(put_cart_cache_part(1, i, frames[1][i], 1) == -1) return(-1);
+        }
+        for(i = 0; i < 32; i++) { //scan in partition 0
+            if(put_cart_cache(0, i, frames[0][i % 5]) == -1) return(-1);
+        }
+        for(i = 0; i < 4; i++) { //minimum survived
+            if(!peek_cart_cache(1, i)) return(-1);
+        }
+        for(i = 0; i < 8; i++) { //partition 2 takes only 2 frames, newest stays
+            if(put_cart_cache_part(2, i, frames[2][i % 5], 2) == -1 || !peek_cart_cache(2, i)) return(-1);
+        }
+        if(cart_cache_stats(&stats) == -1 || stats.partitions[0].frames != 2 || stats.partitions[1].frames != 4 || stats.partitions[2].frames != 2) return(-1);
+        if(set_cart_cache_size(5) == -1 || cart_cache_stats(&stats) == -1 || stats.partitions[1].frames != 4) return(-1); //shrinking keeps the minimum too
+        if(close_cart_cache() == -1) return(-1);
+        memset(cache.partitions, 0, sizeof(cache.partitions)); //back to one unlimited partition
+        partition_reset_targets();
+    }
+
+    cache.policy = &cart_cache_policies[0]; //rebalancing moves room from a scan to a loop that needs it
+    cache.max_cache_size = 16;
+    cache.shard_count = 1;
+    set_cart_cache_partition(1, 0, 0);
+    set_cart_cache_partition(2, 0, 0);
+    set_cart_cache_rebalance(1);
+    if(init_cart_cache() == -1) return(-1);
+    for(i = 0; i < 8000; i++) { //partition 1 loops over 10 frames of cart 1, partition 2 never comes back to cart 2
+        r_frame = (i % 2) ? i / 2 % 10 : i / 2 % CART_CARTRIDGE_SIZE;
+        r_cart = (i % 2) ? 1 : 2;
+        if(get_cart_cache_copy_part(r_cart, r_frame, copy, r_cart) == -1 && put_cart_cache_part(r_cart, r_frame, frames[0][0], r_cart) == -1) return(-1);
+    }
+    if(cart_cache_stats(&stats) == -1 || stats.partition_targets[1] < 10 || stats.partitions[1].frames < 10) return(-1);
+    if(close_cart_cache() == -1) return(-1);
+    set_cart_cache_rebalance(0);
+    memset(cache.partitions, 0, sizeof(cache.partitions));
+    partition_reset_targets();
+
+    for(p = 0; cart_cache_policies[p].name != NULL; p++) { //pinned frames outlive any traffic and take no room from it
+        cache.policy = &cart_cache_policies[p];
+        cache.max_cache_size = 4;
+        cache.shard_count = 1;
+        set_cart_cache_pin_budget(2);
+        if(init_cart_cache() == -1) return(-1);
+        if(pin_cart_cache(0, 0, NULL) == 0 || pin_cart_cache(0, 0, frames[0][0]) == -1) return(-1); //uncached frame needs data
+        if(put_cart_cache(0, 1, frames[0][1]) == -1 || pin_cart_cache(0, 1, NULL) == -1) return(-1); //cached frame is pinned in place
+        if(put_cart_cache(0, 2, frames[0][2]) == -1 || pin_cart_cache(0, 2, NULL) == 0) return(-1); //budget is used up
+        for(i = 0; i < 20; i++) { //traffic over 20 other frames
+            if(get_cart_cache(1, i) == NULL && put_cart_cache(1, i, frames[1][i % 5]) == -1) return(-1);
+        }
+        if(cache.shards[0].current_cache_size != 4) return(-1); //pins didn't take room
+        for(i = 0; i < 2; i++) {
+            if(get_cart_cache_copy(0, i, copy) == -1 || strcmp(copy, data[0][i])) return(-1);
+        }
+        if(unpin_cart_cache(0, 1) == -1 || unpin_cart_cache(0, 1) == 0) return(-1); //unpinned once
+        for(i = 20; i < 40; i++) { //unpinned frame leaves like any other
+            if(get_cart_cache(1, i) == NULL && put_cart_cache(1, i, frames[1][i % 5]) == -1) return(-1);
+        }
+        if(peek_cart_cache(0, 1) || !peek_cart_cache(0, 0) || cache.shards[0].current_cache_size != 4) return(-1);
+        if(cart_cache_stats(&stats) == -1 || stats.pinned_frames != 1) return(-1);
+        set_cart_cache_snapshot("cart_cache_unit.snapshot", 1);
+        set_cart_cache_generation(1);
+        if(close_cart_cache() == -1 || init_cart_cache() == -1) return(-1); //snapshot brings the pin back, counted with the rest
+        if(cache.pinned != 1 || cache.shards[0].current_cache_size != 4 || get_cart_cache_copy(0, 0, copy) == -1 || strcmp(copy, data[0][0])) return(-1);
+        remove("cart_cache_unit.snapshot");
+        set_cart_cache_snapshot(NULL, 0);
+        if(delete_cart_cache(0, 0) == -1 || peek_cart_cache(0, 0) || cache.pinned != 0) return(-1); //deleting drops the pin
+        if(close_cart_cache() == -1) return(-1);
+        set_cart_cache_pin_budget(0);
     }
-    
-    close = close_cart_cache(); //close cache
-    if(close == -1) return(-1); //if close fails, return -1
+    cache.generation = saved_generation;
 
+    cache.max_cache_size = saved_size; //restore cache size
+    cache.shard_count = saved_shards; //restore shard count
+    cache.policy = saved_policy; //restore policy
+    cache.admission = saved_admission; //restore admission filter
 	logMessage(LOG_OUTPUT_LEVEL, "Cache unit test completed successfully."); //output sucess message
 	return(0); //all tests succeeded!
 }
+
+//
+// Benchmark
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchmark_thread
+// Description  : Runs random cache traffic, putting each frame that misses.
+//                Each frame is stamped with its number at both ends, so a
+//                torn or wrong copy is caught.
+//
+// Inputs       : arg - the benchmark_thread_args of thread
+// Outputs      : NULL
+
+void * benchmark_thread(void *arg) {
+    benchmark_thread_args *args = (benchmark_thread_args *) arg; //traffic to run
+    char frame[CART_FRAME_SIZE]; //frame data
+    int i, f; //iterator and frame number
+
+    memset(frame, 0, sizeof(frame));
+    for(i = 0; i < args->ops; i++) { //each get
+        f = rand_r(&args->seed) % args->frames; //random frame of the working set
+        if(get_cart_cache_copy(f / CART_CARTRIDGE_SIZE, f % CART_CARTRIDGE_SIZE, frame) == -1) { //if frame missed
+            memcpy(frame, &f, sizeof(f)); //stamp frame
+            memcpy(&frame[CART_FRAME_SIZE - sizeof(f)], &f, sizeof(f));
+            put_cart_cache(f / CART_CARTRIDGE_SIZE, f % CART_CARTRIDGE_SIZE, frame);
+        } else if(memcmp(frame, &f, sizeof(f)) || memcmp(&frame[CART_FRAME_SIZE - sizeof(f)], &f, sizeof(f))) { //if copy is wrong
+            args->errors++;
+        }
+    }
+    return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cartCacheBenchmark
+// Description  : Times random get/put traffic over twice as many frames as
+//                the cache holds, doubling the threads from 1 up to
+//                "threads", and logs the throughput and speedup of each run
+//
+// Inputs       : threads - most threads to run
+// Outputs      : 0 if successful, -1 if failure
+
+int cartCacheBenchmark(int threads) {
+    pthread_t *tids; //running threads
+    benchmark_thread_args *args; //traffic of each thread
+    struct timespec start, end; //time of run
+    double seconds, base = 0; //time of run, throughput with one thread
+    CacheStats stats; //counters of run
+    int n, i, started, total = 1000000, response = 0; //threads of run, iterator, threads started, gets per run, result
+
+    if(threads < 1 || threads > CART_CACHE_BENCH_MAX_THREADS) return(-1);
+    tids = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+    args = (benchmark_thread_args *) malloc(sizeof(benchmark_thread_args) * threads);
+    if(tids == NULL || args == NULL) { //if allocation fails
+        free(tids);
+        free(args);
+        return(-1);
+    }
+
+    n = 1; //first run is single threaded
+    while(response == 0) { //1, 2, 4 ... threads
+        if(init_cart_cache() == -1) {
+            response = -1;
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for(started = 0; started < n; started++) { //start every thread
+            args[started].seed = started + 1;
+            args[started].ops = total / n;
+            args[started].frames = (cache.max_cache_size * 2 < CART_MAX_CARTRIDGES * CART_CARTRIDGE_SIZE) ? cache.max_cache_size * 2 : CART_MAX_CARTRIDGES * CART_CARTRIDGE_SIZE;
+            args[started].errors = 0;
+            if(pthread_create(&tids[started], NULL, benchmark_thread, &args[started]) != 0) {
+                response = -1;
+                break;
+            }
+        }
+        for(i = 0; i < started; i++) pthread_join(tids[i], NULL); //wait for every thread
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        for(i = 0; i < started; i++) { //every copy must have been right
+            if(args[i].errors) {
+                logMessage(LOG_ERROR_LEVEL, "Cache benchmark: thread %d got %d wrong frames.", i, args[i].errors);
+                response = -1;
+            }
+        }
+        if(response == 0) {
+            seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            if(n == 1) base = total / seconds;
+            cart_cache_stats(&stats);
+            logMessage(LOG_OUTPUT_LEVEL, "Cache benchmark: %d threads, %d shards, %.0f ops/sec, speedup %.2f, hit ratio %.2f%%.", n, cache.shard_count,
+                total / seconds, total / seconds / base, 100.0 * stats.total.hits / (stats.total.hits + stats.total.misses));
+        }
+        if(close_cart_cache() == -1) response = -1;
+
+        if(n == threads) break; //last run done
+        n = (n * 2 > threads) ? threads : n * 2;
+    }
+    free(tids);
+    free(args);
+    return(response);
+}
@@ -14,36 +14,309 @@
 // Includes
 #include <cart_controller.h>
 #include <stdint.h>
+#include <pthread.h>
 // Defines
 #define DEFAULT_CART_FRAME_CACHE_SIZE 1024  // Default size for cache
+#define DEFAULT_CART_CACHE_POLICY "LRU" // Default replacement policy
+#define CART_CACHE_NONE -1 // No slot
+#define CART_CACHE_SLOT_USED 0x1 // Slot holds a frame
+#define CART_CACHE_SLOT_REF 0x2 // Slot was used since the clock hand passed it
+#define CART_CACHE_SLOT_PREFETCHED 0x4 // Slot was prefetched and not used yet
+#define CART_CACHE_SLOT_PINNED 0x8 // Slot is pinned, off the policy's lists and never evicted
+#define CART_CACHE_KEY(cart, frm) (((uint32_t)(cart) << 16) | (uint32_t)(frm)) // Index key of a frame
+#define CART_CACHE_KEY_CART(key) ((CartridgeIndex)((key) >> 16)) // Cart of an index key
+#define CART_CACHE_KEY_FRAME(key) ((CartFrameIndex)((key) & 0xffff)) // Frame of an index key
+#define CART_CACHE_HUGEPAGE_SIZE (2 * 1024 * 1024) // Size of a hugepage
+#define CART_CACHE_LISTS 4 // Lists a policy can keep slots and ghosts on
+#define CART_CACHE_SKETCH_ROWS 4 // Rows of the admission count-min sketch
+#define CART_CACHE_SKETCH_MAX 15 // Largest count a sketch counter holds
+#define CART_CACHE_SKETCH_SAMPLE 10 // Accesses per counter between agings
+#define CART_CACHE_MAX_SHARDS 64 // Most shards the cache can be split into
+#define CART_CACHE_BENCH_MAX_THREADS 1024 // Most threads the cache benchmark runs
+#define CART_CACHE_LINE 64 // Shards are aligned to cache lines so their locks don't share one
+#define CART_CACHE_TIER2_DEFAULT_FRAMES 16384 // Default frames of the second tier file
+#define CART_CACHE_SHARED_DEFAULT_FRAMES 16384 // Default frames of the shared memory segment
+#define CART_CACHE_SHARED_WAYS 8 // Frames in each set of the shared memory segment
+#define CART_CACHE_MRC_KEYS (CART_MAX_CARTRIDGES * CART_CARTRIDGE_SIZE) // Frames the miss ratio curve covers
+#define CART_CACHE_MRC_MODULUS 65536 // Sampling hash range
+#define CART_CACHE_MRC_THRESHOLD 6554 // Sampled if hash is below this, about 10% of frames
+#define CART_CACHE_MRC_BUCKET 16 // Frames per reuse distance histogram bucket
+#define CART_CACHE_MRC_TUNE_PERIOD 4096 // Sampled accesses between auto-tunes
+#define CART_CACHE_MRC_KNEE_SLACK 0.01 // Knee is the smallest size within this miss ratio of the largest
+#define CART_CACHE_MAX_PARTITIONS 16 // Partitions frames can be charged to, 0 is the default
+#define CART_CACHE_PARTITION_GHOSTS 1024 // Recently evicted frames each partition remembers
+#define CART_CACHE_PARTITION_AGES 17 // Buckets of evictions since a returning frame left, by powers of two
+#define CART_CACHE_REBALANCE_PERIOD 128 // Frames added between rebalances of partition targets
+#define CART_CACHE_REBALANCE_SHIFT 4 // A rebalance moves 1/16 of the cache between partitions
 
 //LRU STRUCT
-typedef struct cache_node {
-    char data[CART_FRAME_SIZE]; //data
-    int cart; //cart data is stored in
-    int frame; //frame data is stored in
-    struct cache_node* next; //next in list
-    struct cache_node* prev; //previous in list
+typedef struct cache_node { //metadata of one cache slot, payload lives in Cache.payload
+    int16_t cart; //cart data is stored in
+    int16_t frame; //frame data is stored in
+    int16_t flags; //state of slot
+    int16_t list; //list slot is on
+    int32_t next; //next (older) slot in list, -1 if none
+    int32_t prev; //previous (newer) slot in list, -1 if none
 } cache_node;
 
+//LIST STRUCT
+typedef struct cache_list { //list of slots, oldest at head
+    int32_t head; //oldest slot
+    int32_t tail; //newest slot
+    int32_t size; //slots on list
+} cache_list;
+
+//INDEX STRUCT
+typedef struct cache_index { //open addressing map from (cart, frame) to slot
+    uint64_t* entries; //(key + 1) << 32 | slot, 0 if empty
+    uint32_t mask; //number of entries - 1
+} cache_index;
+
+//SKETCH STRUCT
+typedef struct cache_sketch { //count-min sketch of recent access frequency
+    uint8_t* counters; //CART_CACHE_SKETCH_ROWS rows of mask + 1 counters
+    uint32_t mask; //counters per row - 1
+    uint32_t additions; //accesses counted since last aging
+    uint32_t sample_size; //accesses between agings
+} cache_sketch;
+
+//CART STATS STRUCT
+typedef struct cache_cart_stats { //counters of one cart, added to atomically
+    uint64_t hits; //gets that found frame
+    uint64_t misses; //gets that didn't find frame
+    uint64_t insertions; //frames put into cache
+    uint64_t evictions; //frames evicted to make room
+    uint64_t rejected; //puts not admitted
+    uint64_t prefetches; //frames put by the prefetcher
+    uint64_t prefetch_hits; //prefetched frames used before they left
+    uint64_t prefetch_wasted; //prefetched frames that left unused
+} cache_cart_stats;
+
+//PARTITION STATS STRUCT
+typedef struct cache_partition_stats { //counters of one partition
+    int32_t frames; //frames held, changed under shard lock
+    uint64_t hits; //gets that found frame
+    uint64_t misses; //gets that didn't find frame
+    uint64_t evictions; //frames evicted to make room
+    uint64_t ghost_hits; //frames added again within a cache of evictions after partition evicted them
+} cache_partition_stats;
+
+//STATS STRUCT
+typedef struct cache_stats { //snapshot from cart_cache_stats
+    const char *policy; //name of replacement policy
+    int max_cache_size; //max size of cache
+    int current_cache_size; //frames in cache
+    int shard_count; //number of shards
+    cache_cart_stats total; //counters over every cart
+    uint64_t write_backs; //dirty frames written on eviction, 0 while cache is write-through
+    uint64_t bytes_saved; //bytes not read from the carts thanks to hits
+    int pinned_frames; //frames pinned, not counted in current_cache_size
+    int pin_budget; //most frames that can be pinned
+    int tier2_frames; //frames of second tier, 0 if none
+    uint64_t tier2_hits; //memory misses read back from second tier
+    uint64_t tier2_misses; //memory misses not in second tier
+    uint64_t tier2_writes; //evicted frames written to second tier
+    int shared_frames; //frames of shared memory segment, 0 if none
+    uint64_t shared_hits; //misses served from frames another fetch left in shared memory
+    uint64_t shared_misses; //misses not in shared memory
+    uint64_t shared_stores; //frames stored to shared memory
+    cache_cart_stats carts[CART_MAX_CARTRIDGES]; //counters of each cart
+    cache_partition_stats partitions[CART_CACHE_MAX_PARTITIONS]; //counters of each partition
+    int32_t partition_targets[CART_CACHE_MAX_PARTITIONS]; //frames each partition may keep once cache is full
+} CacheStats;
+
+//POLICY STRUCT
+struct cach_struct;
+typedef struct cache_policy { //replacement policy
+    const char *name; //name of policy
+    int lockless_hit; //whether hit may run without the shard lock
+    int slot_lists; //bit of each list slots are kept on, oldest list first
+    void (*miss)(struct cach_struct*, uint32_t); //key is about to be added
+    void (*insert)(struct cach_struct*, int32_t); //slot was added
+    void (*hit)(struct cach_struct*, int32_t); //slot was used
+    int32_t (*victim)(struct cach_struct*, uint32_t); //slot to evict to make room for key
+    void (*remove)(struct cach_struct*, int32_t, int); //slot is leaving cache, 1 if evicted
+} cache_policy;
+
 //CACHE STRUCT
-typedef struct cach_struct {    
+typedef struct cach_struct { //one shard of the cache, used under its lock
+    pthread_mutex_t lock; //serializes use of shard
     int max_cache_size; //max size of cache
-    cache_node* filled_cache_frames[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE]; //frames stored in cache
-    int current_cache_size; //current size of cache
-    cache_node* head; //top of cache
-    cache_node* tail; //bottom of cache
-} Cache;
+    int capacity; //slots allocated at init, max_cache_size at init plus the pin budget
+    cache_index filled_cache_frames; //slot of each cached frame
+    int current_cache_size; //current size of cache, pinned frames not counted
+    int pinned; //frames pinned in shard
+    cache_list lists[CART_CACHE_LISTS]; //lists kept by policy
+    cache_node* nodes; //metadata of every slot, allocated once at init
+    uint32_t* seqs; //sequence of every slot, odd while slot is changing
+    uint8_t* slot_parts; //partition each slot is charged to
+    char* payload; //frame data of every slot, CART_FRAME_SIZE bytes each
+    size_t payload_size; //bytes in payload region
+    int use_hugepages; //whether to ask for hugepages for payload
+    int payload_mapped; //whether payload was mapped with hugepages
+    int32_t free_nodes; //first unused slot, linked by next
+    cache_node* ghosts; //frames recently evicted, kept without data
+    cache_index ghost_index; //ghost of each remembered frame
+    int32_t free_ghosts; //first unused ghost, linked by next
+    int max_ghosts; //max number of ghosts
+    int ghost_hit; //ghost list of the key being added, -1 if none
+    const cache_policy *policy; //replacement policy
+    int32_t hand; //clock hand
+    int32_t target; //target size of recent list (ARC)
+    int admission; //whether new frames must beat the victim's frequency
+    cache_sketch sketch; //access frequency used for admission
+    uint32_t last_get; //key of last get, +1, 0 if none
+    cache_cart_stats carts[CART_MAX_CARTRIDGES]; //counters of each cart
+    cache_partition_stats parts[CART_CACHE_MAX_PARTITIONS]; //counters of each partition
+} __attribute__((aligned(CART_CACHE_LINE))) Cache;
+
+//MRC STRUCT
+typedef struct cache_mrc { //sampled reuse distances, for the miss ratio curve of LRU
+    pthread_mutex_t lock; //serializes sampled accesses
+    int32_t* last; //time of last access of each sampled frame, -1 if none
+    uint32_t* tree; //fenwick tree, 1 at the time of each frame's last access
+    uint32_t time; //time of next sampled access, from 1
+    uint32_t max_time; //times before tree is compacted
+    uint32_t last_get; //key of last sampled get, +1, 0 if none
+    uint64_t* histogram; //sampled accesses per bucket of scaled reuse distance
+    uint64_t cold; //sampled accesses of frames never seen before
+    uint64_t samples; //sampled accesses
+} cache_mrc;
+
+//TIER2 STRUCT
+typedef struct cache_tier2 { //victim cache in a local file
+    pthread_mutex_t lock; //serializes use of tier
+    int fd; //file frames are kept in
+    int32_t frames; //frames file holds
+    cache_index index; //slot of each frame in file
+    uint32_t* keys; //key + 1 of each slot, 0 if free, NULL if tier not used
+    int32_t* free_slots; //stack of free slots
+    int32_t free_count; //free slots on stack
+    int32_t hand; //next slot to evict when file is full
+    uint64_t hits; //memory misses read back from file
+    uint64_t misses; //memory misses not in file
+    uint64_t writes; //evicted frames written to file
+} cache_tier2;
+
+//SHARED SET STRUCT
+typedef struct cache_shared_set { //one set of the shared memory segment
+    pthread_mutex_t lock; //robust and process-shared, serializes use of set
+    uint64_t clock; //uses of set, stamps ways
+    uint32_t keys[CART_CACHE_SHARED_WAYS]; //key + 1 of each way, 0 if empty
+    uint64_t gens[CART_CACHE_SHARED_WAYS]; //generation of carts each way's frame came from
+    uint64_t stamps[CART_CACHE_SHARED_WAYS]; //clock of last use of each way
+    char data[CART_CACHE_SHARED_WAYS][CART_FRAME_SIZE]; //frame of each way
+} cache_shared_set;
+
+//SHARED SEGMENT STRUCT
+typedef struct cache_shared_segment { //header of the shared memory segment, sets follow
+    uint32_t magic; //set once the creator has set up every set
+    uint32_t sets; //sets in segment
+    uint32_t ways; //frames in each set
+    uint32_t frame_size; //bytes of each frame
+} __attribute__((aligned(CART_CACHE_LINE))) cache_shared_segment;
 
-Cache cache; //new cache
+//SHARED STRUCT
+typedef struct cache_shared { //frame cache in shared memory, for every driver on the host
+    cache_shared_segment* segment; //mapped segment, NULL if tier not used
+    cache_shared_set* sets; //sets of segment
+    size_t length; //bytes mapped
+    uint64_t generation; //stamped on frames this process stores, only frames with it are loaded
+    uint64_t hits; //misses served from segment, by this process
+    uint64_t misses; //misses not in segment, by this process
+    uint64_t stores; //frames stored to segment, by this process
+} cache_shared;
+
+//PARTITION STRUCT
+typedef struct cache_partition { //share of the cache one partition of frames may use
+    int configured; //whether quotas were set, so partition takes part in rebalancing
+    int32_t min_frames; //frames never evicted to make room for other partitions
+    int32_t max_frames; //most frames partition may hold, 0 for no limit
+    int32_t target; //frames partition may keep once cache is full
+    uint64_t gains[CART_CACHE_PARTITION_AGES]; //frames added again since last rebalance, by log2 of evictions since they left
+    uint32_t evictions; //frames evicted, the clock ghosts age by
+    uint64_t ghosts[CART_CACHE_PARTITION_GHOSTS]; //(key + 1) << 32 | evictions when frame left, direct mapped
+} cache_partition;
+
+//CACHE SET STRUCT
+typedef struct cache_set { //whole cache, frames are split over shards by key
+    int max_cache_size; //max size of cache, over all shards
+    int capacity; //frames allocated at init, the most max_cache_size can grow to
+    int32_t pin_budget; //frames that can be pinned, on top of max_cache_size
+    int32_t pinned; //frames pinned over all shards
+    int shard_count; //number of shards, a power of two
+    int use_hugepages; //whether to ask for hugepages for payloads
+    int admission; //whether new frames must beat the victim's frequency
+    const cache_policy *policy; //replacement policy of every shard
+    int track_mrc; //whether to sample reuse distances
+    int autotune; //whether to resize cache to the knee of the miss ratio curve
+    cache_mrc mrc; //sampled reuse distances
+    char* tier2_path; //file of second tier, NULL if none
+    int32_t tier2_frames; //frames of second tier
+    cache_tier2 tier2; //second tier
+    char* shared_name; //shared memory segment, NULL if none
+    int32_t shared_frames; //frames of shared memory segment, if this process creates it
+    cache_shared shared; //shared tier
+    char* snapshot_path; //file resident frames are saved to on close, NULL if none
+    int snapshot_payloads; //whether snapshot keeps frame data, not only keys
+    uint64_t generation; //contents of the carts, 0 if unknown
+    uint32_t* warm_keys; //keys of snapshot left to prefetch, NULL if none
+    int warm_count; //keys left to prefetch
+    int partitioned; //whether any partition has a quota, or targets are rebalanced
+    int rebalance; //whether targets move toward the partition that would gain most
+    uint32_t rebalance_clock; //frames added, a rebalance runs every CART_CACHE_REBALANCE_PERIOD
+    cache_partition partitions[CART_CACHE_MAX_PARTITIONS]; //quota of each partition
+    Cache* shards; //the shards, NULL until init
+} CacheSet;
+
+CacheSet cache; //new cache
 
 ///
 // Cache Interfaces
 int set_cart_cache_size(uint32_t max_frames);
-	// Set the size of the cache (must be called before init)
+	// Set the size of the cache; after init it can shrink, and grow back up to the size at init
+
+int set_cart_cache_shards(uint32_t shards);
+	// Split the cache into independently locked shards (must be called before init)
+
+int set_cart_cache_hugepages(int enable);
+	// Ask for hugepages for the frame payloads (must be called before init)
+
+int set_cart_cache_policy(const char *name);
+	// Select the replacement policy: LRU, CLOCK, 2Q or ARC (must be called before init)
+
+int set_cart_cache_pin_budget(uint32_t frames);
+	// Set how many frames can be pinned, kept in slots of their own beside the cache size (must be called before init)
+
+int set_cart_cache_admission(int enable);
+	// Only admit a new frame if it is used more often than the frame it would evict (must be called before init)
+
+int set_cart_cache_tier2(const char *path, uint32_t frames);
+	// Keep frames evicted from memory in a local file of "frames" frames, 0 for default (must be called before init)
+
+int set_cart_cache_shared(const char *name, uint32_t frames);
+	// Share frames with every driver of the same generation on the host through a shared memory segment of "frames" frames, 0 for default (must be called before init)
+
+int set_cart_cache_snapshot(const char *path, int payloads);
+	// Save resident frames to a file on close and warm the cache from it on init, with data if "payloads" (must be called before init)
+
+int set_cart_cache_generation(uint64_t generation);
+	// Say which contents of the carts the cache mirrors, snapshot data is only restored if it matches (must be called before init)
+
+int set_cart_cache_partition(int part, uint32_t min_frames, uint32_t max_frames);
+	// Reserve "min_frames" for a partition and hold it to "max_frames", 0 for no limit (may be called while running)
+
+int set_cart_cache_rebalance(int enable);
+	// Move frames between partitions toward the one that would gain the most hits (may be called while running)
+
+int set_cart_cache_mrc(int enable);
+	// Sample reuse distances to estimate the miss ratio curve (must be called before init)
+
+int set_cart_cache_autotune(int enable);
+	// Resize the cache to the knee of the miss ratio curve as it runs (must be called before init)
 
 int init_cart_cache(void);
-	// Initialize the cache 
+	// Initialize the cache
 
 int close_cart_cache(void);
 	// Clear all of the contents of the cache, cleanup
@@ -51,15 +324,184 @@ int close_cart_cache(void);
 int put_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *frame);
 	// Put an object into the object cache, evicting other items as necessary
 
+int put_cart_cache_part(CartridgeIndex cart, CartFrameIndex frm, void *frame, int part);
+	// Put an object into the object cache, charging it to partition "part"
+
+void * reserve_cart_cache(CartridgeIndex cart, CartFrameIndex frm, int *valid);
+	// Reserve the slot of a frame to build it in place, NULL if not cached; the shard is locked until commit
+
+void * reserve_cart_cache_part(CartridgeIndex cart, CartFrameIndex frm, int *valid, int part);
+	// Reserve the slot of a frame as reserve_cart_cache does, charging a new slot to partition "part"
+
+int commit_cart_cache(CartridgeIndex cart, CartFrameIndex frm, int keep);
+	// Finish a reservation, keeping the frame if it reached the cart or dropping it if not
+
 void * get_cart_cache(CartridgeIndex dsk, CartFrameIndex blk);
-	// Get an object from the cache (and return it)
+	// Get an object from the cache (and return it), single threaded use only
+
+int prefetch_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *frame);
+	// Put a frame read ahead of demand into the cache, counted in the prefetch statistics
+
+int prefetch_cart_cache_part(CartridgeIndex cart, CartFrameIndex frm, void *frame, int part);
+	// Put a frame read ahead of demand into the cache, charging it to partition "part"
+
+int peek_cart_cache(CartridgeIndex cart, CartFrameIndex frm);
+	// Check whether a frame is cached, without counting or using it
+
+int get_cart_cache_copy(CartridgeIndex cart, CartFrameIndex frm, void *buf);
+	// Copy an object out of the cache, safe to call from several threads
+
+int get_cart_cache_copy_part(CartridgeIndex cart, CartFrameIndex frm, void *buf, int part);
+	// Copy an object out of the cache, charging a miss (and a frame brought back) to partition "part"
+
+int pin_cart_cache(CartridgeIndex cart, CartFrameIndex frm, void *frame);
+	// Pin a frame so it is never evicted, putting "frame" in if it isn't cached (NULL to pin only a cached frame)
+
+int unpin_cart_cache(CartridgeIndex cart, CartFrameIndex frm);
+	// Give a pinned frame back to the replacement policy as a newly added frame
 
 int delete_cart_cache(CartridgeIndex cart, CartFrameIndex blk);
     // Delete object from the cache
+
+int cart_cache_stats(CacheStats *stats);
+	// Get the counters of the cache, over all shards and per cart
+
+//
+// Second tier Interfaces (cart_cache_tier2.c)
+
+int tier2_init(cache_tier2 *t, const char *path, int32_t frames);
+	// Create the file and index of the second tier
+
+void tier2_close(cache_tier2 *t, const char *path);
+	// Close and remove the file of the second tier
+
+void tier2_store(cache_tier2 *t, uint32_t key, const void *data);
+	// Write a frame evicted from memory to the file
+
+int tier2_load(cache_tier2 *t, uint32_t key, void *buf);
+	// Read a frame back from the file, freeing its slot
+
+void tier2_drop(cache_tier2 *t, uint32_t key);
+	// Forget the copy of a frame in the file
+
+//
+// Shared tier Interfaces (cart_cache_shared.c)
+
+int shared_attach(cache_shared *s, const char *name, int32_t frames, uint64_t generation);
+	// Attach to the shared memory segment, creating it if no process has, sharing frames of the same generation only
+
+void shared_detach(cache_shared *s);
+	// Unmap the shared memory segment, leaving it for other processes
+
+void shared_store(cache_shared *s, uint32_t key, const void *data);
+	// Store the current copy of a frame for every process
+
+int shared_load(cache_shared *s, uint32_t key, void *buf);
+	// Copy a frame out of the segment, if some process of the same generation stored it
+
+void shared_drop(cache_shared *s, uint32_t key);
+	// Forget the copy of a frame, for every process
+
+//
+// Snapshot Interfaces (cart_cache_snapshot.c)
+
+int save_cart_cache_snapshot(void);
+	// Write every resident frame to the snapshot file, oldest first
+
+int load_cart_cache_snapshot(void);
+	// Restore frames (or just their keys) from the snapshot file
+
+int cart_cache_warm_keys(uint32_t *keys, int max);
+	// Get the keys of the snapshot to prefetch from the carts, in cart order
+
+//
+// Partition Interfaces (cart_cache_partition.c)
+
+int partition_full(Cache *c, int part);
+	// Whether a partition holds all the frames it may in a shard
+
+int32_t partition_victim(Cache *c, int part, int32_t victim);
+	// Slot to evict for a frame of a partition, the policy's victim unless its partition can't give it up
+
+void partition_insert(Cache *c, uint32_t key, int part, int32_t slot);
+	// Charge a new slot to a partition, noting a frame evicted recently
+
+void partition_remove(Cache *c, int32_t slot, int evicted);
+	// Take a leaving slot off its partition, remembering it if evicted
+
+void partition_reset_targets(void);
+	// Split the cache among the configured partitions again
+
+void partition_resize(int32_t from, int32_t to);
+	// Scale the targets of the partitions to a new cache size
+
+//
+// Miss ratio curve Interfaces (cart_cache_mrc.c)
+
+int mrc_init(cache_mrc *mrc);
+	// Create the reuse distance sampler
+
+void mrc_free(cache_mrc *mrc);
+	// Release the reuse distance sampler
+
+int mrc_record(cache_mrc *mrc, uint32_t key, int put);
+	// Note an access, returns 1 when a tune period of samples has passed
+
+double cart_cache_miss_ratio(uint32_t frames);
+	// Estimated LRU miss ratio of a cache of "frames" frames, -1 if nothing sampled
+
+uint32_t cart_cache_mrc_knee(void);
+	// Smallest size whose estimated miss ratio is close to the best, 0 if nothing sampled
+
+//
+// Policy Interfaces (cart_cache_policy.c)
+
+extern const cache_policy cart_cache_policies[];
+	// Every replacement policy, ending with an entry with no name
+
+const cache_policy * find_cart_cache_policy(const char *name);
+	// Find a replacement policy by name
+
+//
+// Helpers for policies and tiers (cart_cache.c)
+
+int index_init(cache_index *index, int capacity);
+	// Create an index with room for "capacity" keys
+
+void index_free(cache_index *index);
+	// Release an index
+
+int32_t index_find(cache_index *index, uint32_t key);
+	// Find the slot of a key
+
+void index_insert(cache_index *index, uint32_t key, int32_t slot);
+	// Add a key to an index
+
+void index_remove(cache_index *index, uint32_t key);
+	// Remove a key from an index
+
+void list_push(Cache *c, cache_node *nodes, int list, int32_t slot);
+	// Make a slot (or ghost) the newest on a list
+
+void list_unlink(Cache *c, cache_node *nodes, int32_t slot);
+	// Take a slot (or ghost) off its list
+
+int32_t ghost_find(Cache *c, uint32_t key);
+	// Find the ghost of an evicted frame
+
+void ghost_add(Cache *c, int list, uint32_t key);
+	// Remember an evicted frame on a ghost list
+
+void ghost_remove(Cache *c, int32_t ghost);
+	// Forget a ghost
+
 //
 // Unit test
 
 int cartCacheUnitTest(void);
 	// Run a UNIT test checking the cache implementation
 
+int cartCacheBenchmark(int threads);
+	// Time random get/put traffic from 1 up to "threads" threads, at most CART_CACHE_BENCH_MAX_THREADS
+
 #endif
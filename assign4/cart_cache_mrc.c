@@ -0,0 +1,265 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_cache_mrc.c
+//  Description    : This is the estimation of the miss ratio curve of the
+//                   cache of the CART driver. A fixed share of frames is
+//                   sampled by hash (SHARDS), and the reuse distance of each
+//                   sampled access - the number of distinct sampled frames
+//                   used since that frame was last used - is found with a
+//                   fenwick tree over access times. Scaled up by the
+//                   sampling rate, the distances give the LRU miss ratio of
+//                   every cache size from one pass over the workload.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+// Project includes
+#include <cart_cache.h>
+// Defines
+#define MRC_BUCKETS (CART_CACHE_MRC_KEYS / CART_CACHE_MRC_BUCKET) // Buckets of the histogram
+
+//MRC ENTRY STRUCT
+typedef struct mrc_entry { //sampled frame and time of its last access, for compaction
+    uint32_t time; //time of last access
+    uint32_t index; //frame number over all carts
+} mrc_entry;
+
+// Function Declarations
+void tree_add(cache_mrc*, uint32_t, int); //adds to count at a time
+uint32_t tree_sum(cache_mrc*, uint32_t); //counts up to a time
+int compare_entry(const void*, const void*); //orders entries by time
+int mrc_compact(cache_mrc*); //renumbers times from 1
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tree_add
+// Description  : Adds to the count at a time in the fenwick tree
+//
+// Inputs       : mrc - the sampler
+//                time - the time
+//                delta - amount to add
+// Outputs      : none
+
+void tree_add(cache_mrc *mrc, uint32_t time, int delta) {
+    for(; time <= mrc->max_time; time += time & (-time)) mrc->tree[time] += delta;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tree_sum
+// Description  : Counts the frames whose last access is at or before a time
+//
+// Inputs       : mrc - the sampler
+//                time - the time
+// Outputs      : number of frames
+
+uint32_t tree_sum(cache_mrc *mrc, uint32_t time) {
+    uint32_t sum = 0; //frames counted
+
+    for(; time > 0; time -= time & (-time)) sum += mrc->tree[time];
+    return(sum);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_entry
+// Description  : Orders sampled frames by the time of their last access
+//
+// Inputs       : a, b - the entries
+// Outputs      : <0, 0 or >0 as for qsort
+
+int compare_entry(const void *a, const void *b) {
+    uint32_t x = ((const mrc_entry *)a)->time, y = ((const mrc_entry *)b)->time; //times to compare
+
+    return((x > y) - (x < y));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_compact
+// Description  : Renumbers the last access times from 1 in the same order
+//                once times run out, so the tree never has to grow
+//
+// Inputs       : mrc - the sampler
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_compact(cache_mrc *mrc) {
+    mrc_entry *entries; //sampled frames with a last access
+    uint32_t i, n = 0; //iterator, number of entries
+
+    entries = (mrc_entry *) malloc(sizeof(mrc_entry) * CART_CACHE_MRC_KEYS);
+    if(entries == NULL) return(-1); //if allocation fails
+    for(i = 0; i < CART_CACHE_MRC_KEYS; i++) { //gather every frame with a time
+        if(mrc->last[i] < 0) continue;
+        entries[n].time = mrc->last[i];
+        entries[n].index = i;
+        n++;
+    }
+    qsort(entries, n, sizeof(mrc_entry), compare_entry); //oldest first
+
+    memset(mrc->tree, 0, sizeof(uint32_t) * (mrc->max_time + 1)); //start tree over
+    for(i = 0; i < n; i++) { //same order, new times
+        mrc->last[entries[i].index] = i + 1;
+        tree_add(mrc, i + 1, 1);
+    }
+    mrc->time = n + 1;
+    free(entries);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_init
+// Description  : Create the reuse distance sampler
+//
+// Inputs       : mrc - the sampler
+// Outputs      : 0 if successful, -1 if failure
+
+int mrc_init(cache_mrc *mrc) {
+    memset(mrc, 0, sizeof(cache_mrc));
+    mrc->max_time = CART_CACHE_MRC_KEYS * 2; //every frame can have a time, with room to spare
+    mrc->last = (int32_t *) malloc(sizeof(int32_t) * CART_CACHE_MRC_KEYS);
+    mrc->tree = (uint32_t *) calloc(mrc->max_time + 1, sizeof(uint32_t)); //tree is indexed from 1
+    mrc->histogram = (uint64_t *) calloc(MRC_BUCKETS, sizeof(uint64_t));
+    if(mrc->last == NULL || mrc->tree == NULL || mrc->histogram == NULL || pthread_mutex_init(&mrc->lock, NULL) != 0) {
+        mrc_free(mrc);
+        return(-1);
+    }
+    memset(mrc->last, 0xff, sizeof(int32_t) * CART_CACHE_MRC_KEYS); //no frame used yet
+    mrc->time = 1;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_free
+// Description  : Release the reuse distance sampler
+//
+// Inputs       : mrc - the sampler
+// Outputs      : none
+
+void mrc_free(cache_mrc *mrc) {
+    if(mrc->tree != NULL) pthread_mutex_destroy(&mrc->lock);
+    free(mrc->last);
+    free(mrc->tree);
+    free(mrc->histogram);
+    mrc->last = NULL;
+    mrc->tree = NULL;
+    mrc->histogram = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mrc_record
+// Description  : Note an access to a frame. Frames outside the sample are
+//                ignored without taking the lock. A put right after a get
+//                of the same frame is the same access.
+//
+// Inputs       : mrc - the sampler
+//                key - index key of the frame
+//                put - 1 for a put, 0 for a get
+// Outputs      : 1 when a tune period of samples has passed, 0 otherwise
+
+int mrc_record(cache_mrc *mrc, uint32_t key, int put) {
+    uint32_t cart = CART_CACHE_KEY_CART(key), frame = CART_CACHE_KEY_FRAME(key), index, distance, bucket; //frame, its reuse distance and bucket
+    int tune; //whether to tune
+
+    if(mrc->tree == NULL || cart >= CART_MAX_CARTRIDGES || frame >= CART_CARTRIDGE_SIZE) return(0); //not sampling, or not a frame
+    if((((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 48) >= CART_CACHE_MRC_THRESHOLD) return(0); //frame is outside sample
+
+    pthread_mutex_lock(&mrc->lock);
+    if(put && mrc->last_get == key + 1) { //put of a get that missed
+        mrc->last_get = 0;
+        pthread_mutex_unlock(&mrc->lock);
+        return(0);
+    }
+    mrc->last_get = put ? 0 : key + 1;
+
+    if(mrc->time > mrc->max_time && mrc_compact(mrc) == -1) { //if times ran out and can't be renumbered
+        pthread_mutex_unlock(&mrc->lock);
+        return(0);
+    }
+
+    index = cart * CART_CARTRIDGE_SIZE + frame;
+    if(mrc->last[index] >= 0) { //frame was used before
+        distance = tree_sum(mrc, mrc->time - 1) - tree_sum(mrc, mrc->last[index]); //distinct sampled frames since
+        bucket = (uint32_t)((uint64_t)distance * CART_CACHE_MRC_MODULUS / CART_CACHE_MRC_THRESHOLD / CART_CACHE_MRC_BUCKET); //scaled to all frames
+        mrc->histogram[(bucket < MRC_BUCKETS) ? bucket : MRC_BUCKETS - 1]++;
+        tree_add(mrc, mrc->last[index], -1); //old access no longer the last
+    } else { //first use of frame
+        mrc->cold++;
+    }
+    tree_add(mrc, mrc->time, 1);
+    mrc->last[index] = mrc->time++;
+    mrc->samples++;
+    tune = (mrc->samples % CART_CACHE_MRC_TUNE_PERIOD == 0);
+    pthread_mutex_unlock(&mrc->lock);
+    return(tune);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_cache_miss_ratio
+// Description  : Estimated LRU miss ratio of a cache of "frames" frames. An
+//                access hits if its reuse distance is below the size, and a
+//                bucket only counts as hits once all of it is below.
+//
+// Inputs       : frames - size of cache
+// Outputs      : miss ratio from 0 to 1, -1 if nothing sampled
+
+double cart_cache_miss_ratio(uint32_t frames) {
+    cache_mrc *mrc = &cache.mrc; //sampler of cache
+    uint64_t misses; //sampled accesses that would miss
+    uint32_t b; //bucket
+    double ratio = -1; //miss ratio
+
+    if(mrc->tree == NULL) return(-1); //not sampling
+    pthread_mutex_lock(&mrc->lock);
+    if(mrc->samples > 0) {
+        misses = mrc->cold;
+        for(b = 0; b < MRC_BUCKETS; b++) { //buckets not wholly below size miss
+            if((b + 1) * CART_CACHE_MRC_BUCKET > frames) misses += mrc->histogram[b];
+        }
+        ratio = (double)misses / mrc->samples;
+    }
+    pthread_mutex_unlock(&mrc->lock);
+    return(ratio);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_cache_mrc_knee
+// Description  : Smallest size whose estimated miss ratio is within
+//                CART_CACHE_MRC_KNEE_SLACK of the ratio with every frame
+//                cached. Past it, more frames buy almost nothing.
+//
+// Inputs       : none
+// Outputs      : size in frames, 0 if nothing sampled
+
+uint32_t cart_cache_mrc_knee(void) {
+    cache_mrc *mrc = &cache.mrc; //sampler of cache
+    uint64_t reused = 0, below = 0; //sampled reuses, reuses below size
+    uint32_t b, knee = 0; //bucket, knee of curve
+
+    if(mrc->tree == NULL) return(0); //not sampling
+    pthread_mutex_lock(&mrc->lock);
+    if(mrc->samples > 0) {
+        for(b = 0; b < MRC_BUCKETS; b++) reused += mrc->histogram[b];
+        for(b = 0; b < MRC_BUCKETS; b++) { //grow size a bucket at a time
+            below += mrc->histogram[b];
+            if((double)(reused - below) / mrc->samples <= CART_CACHE_MRC_KNEE_SLACK) { //only cold misses and slack left
+                knee = (b + 1) * CART_CACHE_MRC_BUCKET;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mrc->lock);
+    return(knee);
+}
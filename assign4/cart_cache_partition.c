@@ -0,0 +1,387 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_cache_partition.c
+//  Description    : This is the partitioning of the cache of the CART driver.
+//                   Every slot is charged to the partition (a file or a
+//                   tenant) the caller names when the frame is added, so
+//                   only slots carry one. Each partition can reserve a
+//                   minimum of frames and be held to a maximum, so one
+//                   scan can't take the whole cache. With rebalancing on, the
+//                   cache is split into targets that move a step at a time
+//                   toward the partition that would gain the most hits per
+//                   frame of room, judged from how soon its evicted frames
+//                   come back.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Project includes
+#include <cart_cache.h>
+// Defines
+#define PARTITION_OWN 0 // Victim must come from the partition of the frame being added
+#define PARTITION_OVER_TARGET 1 // Victim must come from a partition over its target
+#define PARTITION_OVER_MIN 2 // Victim must come from a partition over its minimum
+
+// Function Declarations
+int32_t partition_share(Cache*, int32_t); //gets a shard's part of a number of frames
+int32_t partition_target(int); //gets target of partition
+int partition_gives_way(Cache*, int, int, int); //decides whether partition can lose a frame
+int32_t partition_scan(Cache*, int32_t, int, int); //finds slot of a partition that can lose a frame
+uint32_t partition_ghost_home(uint32_t); //gets ghost entry of key
+double partition_utility(int); //gets hits per frame partition would gain from room
+void partition_rebalance(void); //moves a step of frames between targets
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_share
+// Description  : Gets a shard's part of a number of frames of the whole
+//                cache. Keys spread evenly over shards, so quotas do too.
+//
+// Inputs       : c - the shard
+//                frames - frames of the whole cache
+// Outputs      : frames of shard
+
+int32_t partition_share(Cache *c, int32_t frames) {
+    if(cache.max_cache_size == 0) return(frames);
+    return((int32_t)((int64_t)frames * c->max_cache_size / cache.max_cache_size));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_target
+// Description  : Gets the target of a partition, which a rebalance on
+//                another shard may be changing
+//
+// Inputs       : part - the partition
+// Outputs      : frames partition may keep once cache is full
+
+int32_t partition_target(int part) {
+    return(__atomic_load_n(&cache.partitions[part].target, __ATOMIC_RELAXED));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_full
+// Description  : Checks whether the partition of a frame holds as many
+//                frames of a shard as its maximum allows, whether or not
+//                the shard has room
+//
+// Inputs       : c - the shard
+//                part - partition of the frame being added
+// Outputs      : 1 if partition must evict its own frame first, 0 if not
+
+int partition_full(Cache *c, int part) {
+    int32_t cap; //frames partition may hold in shard
+
+    if(!cache.partitioned) return(0); //no quotas
+    if(cache.partitions[part].max_frames == 0) return(0); //no limit
+    cap = partition_share(c, cache.partitions[part].max_frames);
+    return(c->parts[part].frames >= ((cap < 1) ? 1 : cap));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_gives_way
+// Description  : Decides whether a partition can lose a frame of a shard
+//
+// Inputs       : c - the shard
+//                part - partition of the slot
+//                want - partition of the frame being added
+//                rule - PARTITION_* rule victims must meet
+// Outputs      : 1 if partition can lose a frame, 0 if not
+
+int partition_gives_way(Cache *c, int part, int want, int rule) {
+    if(rule == PARTITION_OWN) return(part == want);
+    if(rule == PARTITION_OVER_TARGET) return(c->parts[part].frames > partition_share(c, partition_target(part)));
+    return(c->parts[part].frames > partition_share(c, cache.partitions[part].min_frames));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_scan
+// Description  : Finds the slot the policy would evict soonest among those
+//                of partitions that can lose one. Lists are walked oldest
+//                first, starting with the list of the policy's victim; a
+//                policy without lists is swept from its hand, slots not
+//                used since the last sweep first.
+//
+// Inputs       : c - the shard
+//                victim - slot the policy chose
+//                want - partition of the frame being added
+//                rule - PARTITION_* rule victims must meet
+// Outputs      : slot to evict, CART_CACHE_NONE if no slot meets rule
+
+int32_t partition_scan(Cache *c, int32_t victim, int want, int rule) {
+    int32_t slot, i; //slot looked at, iterator
+    int list, pass; //list walked, sweep
+    int16_t flags; //state of slot
+
+    if(c->policy->slot_lists == 0) { //no lists, sweep like CLOCK
+        for(pass = 0; pass < 2; pass++) { //unreferenced slots, then any
+            for(i = 0; i < c->capacity; i++) {
+                slot = (c->hand + i) % c->capacity;
+                flags = __atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED);
+                if((flags & (CART_CACHE_SLOT_USED | CART_CACHE_SLOT_PINNED)) != CART_CACHE_SLOT_USED || (pass == 0 && (flags & CART_CACHE_SLOT_REF))) continue;
+                if(partition_gives_way(c, c->slot_parts[slot], want, rule)) return(slot);
+            }
+        }
+        return(CART_CACHE_NONE);
+    }
+
+    for(slot = victim; slot != CART_CACHE_NONE; slot = c->nodes[slot].prev) { //rest of victim's list
+        if(partition_gives_way(c, c->slot_parts[slot], want, rule)) return(slot);
+    }
+    for(list = 0; list < CART_CACHE_LISTS; list++) { //then the other lists, oldest list first
+        if(!(c->policy->slot_lists & (1 << list)) || list == c->nodes[victim].list) continue;
+        for(slot = c->lists[list].head; slot != CART_CACHE_NONE; slot = c->nodes[slot].prev) {
+            if(partition_gives_way(c, c->slot_parts[slot], want, rule)) return(slot);
+        }
+    }
+    return(CART_CACHE_NONE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_victim
+// Description  : Picks the slot to evict for a frame. A partition at its
+//                maximum evicts its own frame. Otherwise the victim comes
+//                from a partition over its target if there is one, and
+//                never takes a partition below its minimum. The policy's
+//                victim is kept whenever it meets that.
+//
+// Inputs       : c - the shard
+//                want - partition of the frame being added
+//                victim - slot the policy chose
+// Outputs      : slot to evict
+
+int32_t partition_victim(Cache *c, int want, int32_t victim) {
+    int rule, i; //rule victims must meet, partition
+    int32_t slot; //slot meeting rule
+
+    if(!cache.partitioned) return(victim); //every slot can go
+    if(partition_full(c, want)) { //partition at its maximum makes its own room
+        rule = PARTITION_OWN;
+    } else { //partitions over target give way first, then those over minimum
+        rule = PARTITION_OVER_MIN;
+        for(i = 0; i < CART_CACHE_MAX_PARTITIONS && rule == PARTITION_OVER_MIN; i++) {
+            if(partition_gives_way(c, i, want, PARTITION_OVER_TARGET)) rule = PARTITION_OVER_TARGET;
+        }
+    }
+    if(partition_gives_way(c, c->slot_parts[victim], want, rule)) return(victim); //policy's choice is fine
+    slot = partition_scan(c, victim, want, rule);
+    return((slot == CART_CACHE_NONE) ? victim : slot); //minimums can't all be kept, policy decides
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_ghost_home
+// Description  : Gets the ghost entry of a key in a partition's table
+//
+// Inputs       : key - index key of the frame
+// Outputs      : entry of key
+
+uint32_t partition_ghost_home(uint32_t key) {
+    return(((key * 2654435761u) >> 16) % CART_CACHE_PARTITION_GHOSTS); //multiplicative hash
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_insert
+// Description  : Charges a new slot to the partition of its frame. A frame
+//                the partition evicted "age" evictions ago would have been
+//                a hit had the partition been about "age" frames bigger, so
+//                it is counted in the bucket of its age for rebalancing.
+//
+// Inputs       : c - the shard
+//                key - index key of the frame
+//                part - partition charged, the caller's
+//                slot - the slot added
+// Outputs      : none
+
+void partition_insert(Cache *c, uint32_t key, int part, int32_t slot) {
+    cache_partition *to = &cache.partitions[part]; //quota of partition
+    uint64_t *ghost = &to->ghosts[partition_ghost_home(key)]; //entry frame would be remembered in
+    uint64_t entry = __atomic_load_n(ghost, __ATOMIC_RELAXED); //frame remembered there
+    uint32_t age; //evictions since frame left
+    int bucket = 0; //log2 of age
+
+    __atomic_store_n(&c->slot_parts[slot], (uint8_t)part, __ATOMIC_RELAXED); //lockless gets count hits by it
+    c->parts[part].frames++;
+    if((uint32_t)(entry >> 32) == key + 1) { //evicted before, see how long ago
+        __atomic_store_n(ghost, 0, __ATOMIC_RELAXED);
+        age = __atomic_load_n(&to->evictions, __ATOMIC_RELAXED) - (uint32_t)entry;
+        if(age <= (uint32_t)cache.max_cache_size) { //room the cache could give would have kept it
+            while(bucket < CART_CACHE_PARTITION_AGES - 1 && (age >> (bucket + 1)) != 0) bucket++;
+            __atomic_fetch_add(&c->parts[part].ghost_hits, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&to->gains[bucket], 1, __ATOMIC_RELAXED);
+        }
+    }
+    if(cache.rebalance && __atomic_add_fetch(&cache.rebalance_clock, 1, __ATOMIC_RELAXED) % CART_CACHE_REBALANCE_PERIOD == 0) {
+        partition_rebalance(); //one thread gets each multiple of the period
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_remove
+// Description  : Takes a leaving slot off its partition, and remembers the
+//                frame if it was evicted to make room
+//
+// Inputs       : c - the shard
+//                slot - the slot leaving
+//                evicted - 1 if evicted, 0 if deleted
+// Outputs      : none
+
+void partition_remove(Cache *c, int32_t slot, int evicted) {
+    int part = c->slot_parts[slot]; //partition charged
+    uint32_t key = CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame); //frame leaving
+
+    c->parts[part].frames--;
+    if(!evicted) return; //deleted frames aren't missed
+    __atomic_fetch_add(&c->parts[part].evictions, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&cache.partitions[part].ghosts[partition_ghost_home(key)],
+        (uint64_t)(key + 1) << 32 | __atomic_add_fetch(&cache.partitions[part].evictions, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_utility
+// Description  : Gets the most hits per frame a partition would gain from
+//                more room. Growing by 2^(b+1) frames catches every frame
+//                that came back in age buckets up to b, and the best ratio
+//                over b is kept, so a loop just past the partition's size
+//                is seen even if the first frames of room buy nothing.
+//
+// Inputs       : part - the partition
+// Outputs      : hits per frame of room
+
+double partition_utility(int part) {
+    double best = 0, hits = 0; //best hits per frame, hits caught so far
+    int b; //age bucket
+
+    for(b = 0; b < CART_CACHE_PARTITION_AGES; b++) {
+        hits += __atomic_load_n(&cache.partitions[part].gains[b], __ATOMIC_RELAXED);
+        if(hits / ((uint64_t)2 << b) > best) best = hits / ((uint64_t)2 << b);
+    }
+    return(best);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_rebalance
+// Description  : Moves a step of frames to the target of the partition that
+//                would gain most per frame from the one that would gain
+//                least, within their minimums and maximums. Gains are
+//                halved after, so old behaviour fades.
+//
+// Inputs       : none
+// Outputs      : none
+
+void partition_rebalance(void) {
+    int i, b, take = -1, give = -1; //partition, age bucket, partitions getting and giving frames
+    int32_t step, limit, room; //frames moved, most take can hold, frames give can lose
+    double utility[CART_CACHE_MAX_PARTITIONS]; //hits per frame each partition would gain
+    cache_partition *part; //partition looked at
+
+    for(i = 0; i < CART_CACHE_MAX_PARTITIONS; i++) { //partition gaining most that can grow
+        part = &cache.partitions[i];
+        utility[i] = partition_utility(i);
+        limit = (part->max_frames != 0) ? part->max_frames : cache.max_cache_size;
+        if((i == 0 || part->configured) && partition_target(i) < limit && (take == -1 || utility[i] > utility[take])) take = i;
+    }
+    for(i = 0; i < CART_CACHE_MAX_PARTITIONS; i++) { //partition gaining least that can shrink
+        part = &cache.partitions[i];
+        if(i != take && (i == 0 || part->configured) && partition_target(i) > part->min_frames && (give == -1 || utility[i] < utility[give])) give = i;
+    }
+
+    if(take != -1 && give != -1 && utility[take] > utility[give]) {
+        step = cache.max_cache_size >> CART_CACHE_REBALANCE_SHIFT;
+        if(step < 1) step = 1;
+        room = partition_target(give) - cache.partitions[give].min_frames;
+        if(step > room) step = room;
+        limit = (cache.partitions[take].max_frames != 0) ? cache.partitions[take].max_frames : cache.max_cache_size;
+        if(step > limit - partition_target(take)) step = limit - partition_target(take);
+        __atomic_store_n(&cache.partitions[give].target, partition_target(give) - step, __ATOMIC_RELAXED);
+        __atomic_store_n(&cache.partitions[take].target, partition_target(take) + step, __ATOMIC_RELAXED);
+    }
+    for(i = 0; i < CART_CACHE_MAX_PARTITIONS; i++) { //old gains fade
+        for(b = 0; b < CART_CACHE_PARTITION_AGES; b++) {
+            __atomic_store_n(&cache.partitions[i].gains[b], __atomic_load_n(&cache.partitions[i].gains[b], __ATOMIC_RELAXED) / 2, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_reset_targets
+// Description  : Sets the target of every partition again. Without
+//                rebalancing a partition's target is its maximum. With it,
+//                each configured partition (and the default one) gets its
+//                minimum plus an even part of the rest, and the others get
+//                nothing they can keep once the cache is full.
+//
+// Inputs       : none
+// Outputs      : none
+
+void partition_reset_targets(void) {
+    int i, count = 0; //partition, partitions splitting cache
+    int32_t left = cache.max_cache_size, share, target; //frames not reserved, even part of them, target of partition
+    cache_partition *part; //partition set
+
+    cache.partitioned = cache.rebalance;
+    for(i = 0; i < CART_CACHE_MAX_PARTITIONS; i++) { //reserve minimums first
+        part = &cache.partitions[i];
+        if(part->min_frames != 0 || part->max_frames != 0) cache.partitioned = 1;
+        if(!cache.rebalance) {
+            target = (part->max_frames != 0) ? part->max_frames : cache.max_cache_size;
+        } else if(i == 0 || part->configured) {
+            target = part->min_frames;
+            left -= part->min_frames;
+            count++;
+        } else {
+            target = 0;
+        }
+        __atomic_store_n(&part->target, target, __ATOMIC_RELAXED);
+    }
+    if(!cache.rebalance) return;
+
+    share = (left > 0) ? left / count : 0;
+    for(i = 0; i < CART_CACHE_MAX_PARTITIONS; i++) { //then split the rest
+        part = &cache.partitions[i];
+        if(i != 0 && !part->configured) continue;
+        target = part->target + share;
+        if(part->max_frames != 0 && target > part->max_frames) target = part->max_frames;
+        __atomic_store_n(&part->target, target, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partition_resize
+// Description  : Follows a change of the cache size. Rebalanced targets
+//                keep their share of the cache, so what was learned stays.
+//
+// Inputs       : from - old size of the cache
+//                to - new size of the cache
+// Outputs      : none
+
+void partition_resize(int32_t from, int32_t to) {
+    int i; //partition
+    cache_partition *part; //partition scaled
+    int32_t target; //new target
+
+    if(!cache.rebalance || from == 0) {
+        partition_reset_targets();
+        return;
+    }
+    for(i = 0; i < CART_CACHE_MAX_PARTITIONS; i++) {
+        part = &cache.partitions[i];
+        target = (int32_t)((int64_t)partition_target(i) * to / from);
+        if(target < part->min_frames) target = part->min_frames;
+        __atomic_store_n(&part->target, target, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,414 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_cache_policy.c
+//  Description    : This is the implementation of the replacement policies
+//                   for the cache of the CART driver.
+//
+//                   LRU   - evict the least recently used frame
+//                   CLOCK - sweep a hand over the slots, evicting the first
+//                           frame not used since the last sweep. A hit only
+//                           sets a bit, so hits can skip the shard lock.
+//                   2Q    - new frames wait in a FIFO, and only frames that
+//                           come back after leaving it reach the main LRU
+//                   ARC   - balance a recent and a frequent LRU, adapting
+//                           the split from the ghosts of evicted frames
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <string.h>
+// Project includes
+#include <cart_cache.h>
+// Defines
+#define LRU_LIST 0 // Only list of LRU
+#define TWOQ_IN 0 // 2Q FIFO of new frames
+#define TWOQ_MAIN 1 // 2Q LRU of frames seen twice
+#define TWOQ_OUT 2 // 2Q ghosts of frames that left the FIFO
+#define TWOQ_IN_PERCENT 25 // Share of cache for 2Q FIFO
+#define TWOQ_OUT_PERCENT 50 // Ghosts kept by 2Q, as share of cache
+#define ARC_T1 0 // ARC frames seen once recently
+#define ARC_T2 1 // ARC frames seen at least twice recently
+#define ARC_B1 2 // ARC ghosts of frames evicted from T1
+#define ARC_B2 3 // ARC ghosts of frames evicted from T2
+
+// Function Declarations
+void no_miss(Cache*, uint32_t); //policy keeps no ghosts
+void lru_insert(Cache*, int32_t); //LRU slot was added
+void lru_hit(Cache*, int32_t); //LRU slot was used
+int32_t lru_victim(Cache*, uint32_t); //LRU slot to evict
+void lru_remove(Cache*, int32_t, int); //LRU slot is leaving
+void clock_insert(Cache*, int32_t); //CLOCK slot was added
+void clock_hit(Cache*, int32_t); //CLOCK slot was used
+int32_t clock_victim(Cache*, uint32_t); //CLOCK slot to evict
+void clock_remove(Cache*, int32_t, int); //CLOCK slot is leaving
+void twoq_miss(Cache*, uint32_t); //2Q key is about to be added
+void twoq_insert(Cache*, int32_t); //2Q slot was added
+void twoq_hit(Cache*, int32_t); //2Q slot was used
+int32_t twoq_victim(Cache*, uint32_t); //2Q slot to evict
+void twoq_remove(Cache*, int32_t, int); //2Q slot is leaving
+void arc_miss(Cache*, uint32_t); //ARC key is about to be added
+void arc_insert(Cache*, int32_t); //ARC slot was added
+void arc_hit(Cache*, int32_t); //ARC slot was used
+int32_t arc_victim(Cache*, uint32_t); //ARC slot to evict
+void arc_remove(Cache*, int32_t, int); //ARC slot is leaving
+
+// Global data
+const cache_policy cart_cache_policies[] = {
+    { "LRU", 0, 0x1, no_miss, lru_insert, lru_hit, lru_victim, lru_remove },
+    { "CLOCK", 1, 0x0, no_miss, clock_insert, clock_hit, clock_victim, clock_remove },
+    { "2Q", 0, 0x3, twoq_miss, twoq_insert, twoq_hit, twoq_victim, twoq_remove },
+    { "ARC", 0, 0x3, arc_miss, arc_insert, arc_hit, arc_victim, arc_remove },
+    { NULL, 0, 0, NULL, NULL, NULL, NULL, NULL }
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_cart_cache_policy
+// Description  : Find a replacement policy by name
+//
+// Inputs       : name - name of the policy
+// Outputs      : the policy, or NULL if there is none with that name
+
+const cache_policy * find_cart_cache_policy(const char *name) {
+    int i; //iterator
+
+    for(i = 0; cart_cache_policies[i].name != NULL; i++) { //check each policy
+        if(strcasecmp(cart_cache_policies[i].name, name) == 0) return(&cart_cache_policies[i]);
+    }
+    return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : no_miss
+// Description  : Miss handler for policies that keep no ghosts
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+// Outputs      : none
+
+void no_miss(Cache *c, uint32_t key) {
+    return; //nothing to remember
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lru_insert
+// Description  : LRU puts a new slot at the newest end of its list
+//
+// Inputs       : c - the cache
+//                slot - the slot added
+// Outputs      : none
+
+void lru_insert(Cache *c, int32_t slot) {
+    list_push(c, c->nodes, LRU_LIST, slot); //slot is newest
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lru_hit
+// Description  : LRU moves a used slot to the newest end of its list
+//
+// Inputs       : c - the cache
+//                slot - the slot used
+// Outputs      : none
+
+void lru_hit(Cache *c, int32_t slot) {
+    if(c->lists[LRU_LIST].tail == slot) return; //already newest
+    list_unlink(c, c->nodes, slot); //take slot out of its place
+    list_push(c, c->nodes, LRU_LIST, slot); //slot is newest
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lru_victim
+// Description  : LRU evicts the oldest slot
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+// Outputs      : slot to evict
+
+int32_t lru_victim(Cache *c, uint32_t key) {
+    return(c->lists[LRU_LIST].head); //oldest slot
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lru_remove
+// Description  : LRU takes a leaving slot off its list
+//
+// Inputs       : c - the cache
+//                slot - the slot leaving
+//                evicted - 1 if evicted, 0 if deleted
+// Outputs      : none
+
+void lru_remove(Cache *c, int32_t slot, int evicted) {
+    list_unlink(c, c->nodes, slot); //take slot off list
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clock_insert
+// Description  : CLOCK adds a slot without a reference, so a frame that is
+//                never used again is evicted on the next sweep
+//
+// Inputs       : c - the cache
+//                slot - the slot added
+// Outputs      : none
+
+void clock_insert(Cache *c, int32_t slot) {
+    __atomic_fetch_and(&c->nodes[slot].flags, ~CART_CACHE_SLOT_REF, __ATOMIC_RELAXED); //not used yet
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clock_hit
+// Description  : CLOCK marks a used slot so the hand passes it once. This
+//                is a single atomic update, so it may run without the lock.
+//
+// Inputs       : c - the cache
+//                slot - the slot used
+// Outputs      : none
+
+void clock_hit(Cache *c, int32_t slot) {
+    __atomic_fetch_or(&c->nodes[slot].flags, CART_CACHE_SLOT_REF, __ATOMIC_RELAXED); //used since hand passed, may run without lock
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clock_victim
+// Description  : CLOCK sweeps the hand over the slots, clearing references,
+//                and evicts the first slot without one
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+// Outputs      : slot to evict
+
+int32_t clock_victim(Cache *c, uint32_t key) {
+    int32_t slot; //slot under hand
+
+    while(1) { //sweep until a slot without a reference is found
+        slot = c->hand; //slot under hand
+        c->hand = (c->hand + 1) % c->capacity; //move hand past slot, slots past a shrunk size may still be used
+        if((__atomic_load_n(&c->nodes[slot].flags, __ATOMIC_RELAXED) & (CART_CACHE_SLOT_USED | CART_CACHE_SLOT_PINNED)) != CART_CACHE_SLOT_USED) continue; //skip unused and pinned slots
+        if(__atomic_fetch_and(&c->nodes[slot].flags, ~CART_CACHE_SLOT_REF, __ATOMIC_RELAXED) & CART_CACHE_SLOT_REF) { //if used since last sweep, give it one more
+            continue;
+        }
+        return(slot);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clock_remove
+// Description  : CLOCK keeps no lists, so a leaving slot needs nothing
+//
+// Inputs       : c - the cache
+//                slot - the slot leaving
+//                evicted - 1 if evicted, 0 if deleted
+// Outputs      : none
+
+void clock_remove(Cache *c, int32_t slot, int evicted) {
+    return; //slot is skipped once unused
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : twoq_miss
+// Description  : 2Q checks whether a frame being added left the FIFO
+//                recently
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+// Outputs      : none
+
+void twoq_miss(Cache *c, uint32_t key) {
+    int32_t ghost = ghost_find(c, key); //ghost of frame
+
+    if(ghost != CART_CACHE_NONE) { //if frame came back
+        c->ghost_hit = TWOQ_OUT; //frame goes to main LRU
+        ghost_remove(c, ghost); //frame is cached again
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : twoq_insert
+// Description  : 2Q puts frames that came back on the main LRU, and new
+//                frames on the FIFO
+//
+// Inputs       : c - the cache
+//                slot - the slot added
+// Outputs      : none
+
+void twoq_insert(Cache *c, int32_t slot) {
+    list_push(c, c->nodes, (c->ghost_hit == TWOQ_OUT) ? TWOQ_MAIN : TWOQ_IN, slot); //place slot
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : twoq_hit
+// Description  : 2Q moves a used slot on the main LRU to its newest end. A
+//                hit in the FIFO is ignored, so a burst of uses counts once.
+//
+// Inputs       : c - the cache
+//                slot - the slot used
+// Outputs      : none
+
+void twoq_hit(Cache *c, int32_t slot) {
+    if(c->nodes[slot].list != TWOQ_MAIN || c->lists[TWOQ_MAIN].tail == slot) return; //FIFO or already newest
+    list_unlink(c, c->nodes, slot); //take slot out of its place
+    list_push(c, c->nodes, TWOQ_MAIN, slot); //slot is newest
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : twoq_victim
+// Description  : 2Q evicts from the FIFO while it is over its share,
+//                otherwise from the main LRU
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+// Outputs      : slot to evict
+
+int32_t twoq_victim(Cache *c, uint32_t key) {
+    int in_size = c->max_cache_size * TWOQ_IN_PERCENT / 100; //share of FIFO
+
+    if(in_size < 1) in_size = 1;
+    if(c->lists[TWOQ_IN].size > in_size || c->lists[TWOQ_MAIN].size == 0) { //if FIFO is over its share
+        return(c->lists[TWOQ_IN].head); //oldest of FIFO
+    }
+    return(c->lists[TWOQ_MAIN].head); //oldest of main LRU
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : twoq_remove
+// Description  : 2Q takes a leaving slot off its list, and remembers frames
+//                evicted from the FIFO
+//
+// Inputs       : c - the cache
+//                slot - the slot leaving
+//                evicted - 1 if evicted, 0 if deleted
+// Outputs      : none
+
+void twoq_remove(Cache *c, int32_t slot, int evicted) {
+    int out_size = c->max_cache_size * TWOQ_OUT_PERCENT / 100; //ghosts kept
+    int list = c->nodes[slot].list; //list slot was on
+
+    list_unlink(c, c->nodes, slot); //take slot off list
+    if(evicted && list == TWOQ_IN && out_size > 0) { //if frame left FIFO
+        if(c->lists[TWOQ_OUT].size >= out_size) ghost_remove(c, c->lists[TWOQ_OUT].head); //forget oldest ghost
+        ghost_add(c, TWOQ_OUT, CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame)); //remember frame
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_miss
+// Description  : ARC adapts its target for the recent list when a frame
+//                being added was evicted recently. A ghost in B1 means the
+//                recent list was too small, a ghost in B2 that the frequent
+//                list was.
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+// Outputs      : none
+
+void arc_miss(Cache *c, uint32_t key) {
+    int32_t ghost = ghost_find(c, key); //ghost of frame
+    int b1 = c->lists[ARC_B1].size, b2 = c->lists[ARC_B2].size, delta; //ghost list sizes and change of target
+
+    if(ghost == CART_CACHE_NONE) return; //frame is new
+
+    c->ghost_hit = c->ghosts[ghost].list; //list ghost was on
+    if(c->ghost_hit == ARC_B1) { //recent list was too small
+        delta = (b2 > b1) ? b2 / b1 : 1;
+        c->target = (c->target + delta > c->max_cache_size) ? c->max_cache_size : c->target + delta;
+    } else { //frequent list was too small
+        delta = (b1 > b2) ? b1 / b2 : 1;
+        c->target = (c->target - delta < 0) ? 0 : c->target - delta;
+    }
+    ghost_remove(c, ghost); //frame is cached again
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_insert
+// Description  : ARC puts frames seen before on the frequent list, and new
+//                frames on the recent list
+//
+// Inputs       : c - the cache
+//                slot - the slot added
+// Outputs      : none
+
+void arc_insert(Cache *c, int32_t slot) {
+    list_push(c, c->nodes, (c->ghost_hit == CART_CACHE_NONE) ? ARC_T1 : ARC_T2, slot); //place slot
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_hit
+// Description  : ARC moves a used slot to the newest end of the frequent list
+//
+// Inputs       : c - the cache
+//                slot - the slot used
+// Outputs      : none
+
+void arc_hit(Cache *c, int32_t slot) {
+    if(c->lists[ARC_T2].tail == slot) return; //already newest
+    list_unlink(c, c->nodes, slot); //take slot out of its place
+    list_push(c, c->nodes, ARC_T2, slot); //slot is newest frequent
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_victim
+// Description  : ARC evicts from the recent list while it is over its target,
+//                otherwise from the frequent list
+//
+// Inputs       : c - the cache
+//                key - index key of frame being added
+// Outputs      : slot to evict
+
+int32_t arc_victim(Cache *c, uint32_t key) {
+    int t1 = c->lists[ARC_T1].size; //size of recent list
+
+    if(t1 > 0 && (t1 > c->target || (c->ghost_hit == ARC_B2 && t1 == c->target) || c->lists[ARC_T2].size == 0)) {
+        return(c->lists[ARC_T1].head); //oldest recent
+    }
+    return(c->lists[ARC_T2].head); //oldest frequent
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arc_remove
+// Description  : ARC takes a leaving slot off its list and remembers evicted
+//                frames, keeping T1 + B1 within the cache size and all
+//                ghosts within the cache size
+//
+// Inputs       : c - the cache
+//                slot - the slot leaving
+//                evicted - 1 if evicted, 0 if deleted
+// Outputs      : none
+
+void arc_remove(Cache *c, int32_t slot, int evicted) {
+    int list = c->nodes[slot].list; //list slot was on
+    int ghost_list = (list == ARC_T1) ? ARC_B1 : ARC_B2; //ghost list for slot
+
+    list_unlink(c, c->nodes, slot); //take slot off list
+    if(!evicted) return; //deleted frames aren't remembered
+
+    if(ghost_list == ARC_B1 && c->lists[ARC_T1].size + c->lists[ARC_B1].size >= c->max_cache_size && c->lists[ARC_B1].size > 0) {
+        ghost_remove(c, c->lists[ARC_B1].head); //recent side is full, forget oldest B1 ghost
+    }
+    if(c->lists[ARC_B1].size + c->lists[ARC_B2].size >= c->max_ghosts) { //if every ghost is used
+        ghost_remove(c, c->lists[(c->lists[ARC_B2].size > 0) ? ARC_B2 : ARC_B1].head); //forget oldest, frequent side first
+    }
+    ghost_add(c, ghost_list, CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame)); //remember frame
+}
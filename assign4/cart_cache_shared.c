@@ -0,0 +1,348 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_cache_shared.c
+//  Description    : This is the shared tier of the cache of the CART driver,
+//                   a set associative frame cache in a POSIX shared memory
+//                   segment that every driver on the host can attach to.
+//                   Frames read from or written to the carts are stored
+//                   there, so a miss in one process is served from a frame
+//                   another process already fetched. Every frame carries the
+//                   generation of the carts it came from, and only frames of
+//                   the generation of this process are used; an unknown
+//                   generation gets an id of its own, so its frames are never
+//                   mixed with another driver's. The CART driver formats
+//                   the carts at poweron and so always attaches with an
+//                   unknown generation: in this tree a driver only reads
+//                   back frames it stored itself, and frames are not
+//                   shared between drivers. Each set has a robust
+//                   process-shared mutex; if a process dies holding one,
+//                   the next process to lock the set empties it, since its
+//                   frames may be half written.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+// Project includes
+#include <cart_cache.h>
+#include <cmpsc311_log.h>
+// Defines
+#define CART_CACHE_SHARED_MAGIC 0x43415255 // Set once the creator has set up every set, changed with the set layout
+#define CART_CACHE_SHARED_WAIT_US 1000 // Time between looks at a segment still being set up
+#define CART_CACHE_SHARED_WAIT_TRIES 1000 // Looks before giving up on a segment
+
+// Function Declarations
+cache_shared_set * shared_set_of(cache_shared*, uint32_t); //gets set of frame
+int shared_lock(cache_shared_set*); //locks set, recovering it from a dead owner
+int shared_find(cache_shared_set*, uint32_t); //finds way of frame in set
+int shared_create(cache_shared*, int, int32_t); //sets up a new segment
+int shared_open(cache_shared*, int); //maps a segment another process set up
+uint64_t shared_session(void); //gets an id for an unknown generation
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_set_of
+// Description  : Gets the set a frame maps to
+//
+// Inputs       : s - the tier
+//                key - index key of frame
+// Outputs      : the set
+
+cache_shared_set * shared_set_of(cache_shared *s, uint32_t key) {
+    return(&s->sets[(key * 2654435761u) % s->segment->sets]); //multiplicative hash
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_lock
+// Description  : Locks a set. If the process holding it died, the set may
+//                be half written, so every way is emptied before the lock
+//                is marked consistent again.
+//
+// Inputs       : set - the set
+// Outputs      : 0 if successful, -1 if failure
+
+int shared_lock(cache_shared_set *set) {
+    int response = pthread_mutex_lock(&set->lock); //result of lock
+
+    if(response == EOWNERDEAD) { //owner died inside the set
+        memset(set->keys, 0, sizeof(set->keys)); //no way can be trusted
+        pthread_mutex_consistent(&set->lock);
+        logMessage(LOG_WARNING_LEVEL, "Recovered shared cache set from a dead process.");
+        return(0);
+    }
+    return((response == 0) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_find
+// Description  : Finds the way of a frame in a set, the set is locked
+//
+// Inputs       : set - the set
+//                key - index key of frame
+// Outputs      : way of frame, -1 if not in set
+
+int shared_find(cache_shared_set *set, uint32_t key) {
+    int way; //way of set
+
+    for(way = 0; way < CART_CACHE_SHARED_WAYS; way++) {
+        if(set->keys[way] == key + 1) return(way);
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_create
+// Description  : Sets up a segment this process created. Every set gets a
+//                robust process-shared mutex, and the magic is written last
+//                so other processes wait until the segment is ready.
+//
+// Inputs       : s - the tier
+//                fd - the new segment
+//                frames - frames segment holds
+// Outputs      : 0 if successful, -1 if failure
+
+int shared_create(cache_shared *s, int fd, int32_t frames) {
+    pthread_mutexattr_t attr; //lock shared by processes, recovered from dead owners
+    uint32_t sets = (frames + CART_CACHE_SHARED_WAYS - 1) / CART_CACHE_SHARED_WAYS; //sets to hold frames
+    uint32_t i; //set
+
+    s->length = sizeof(cache_shared_segment) + (size_t)sets * sizeof(cache_shared_set);
+    if(ftruncate(fd, s->length) == -1) return(-1); //reserve the whole segment
+    s->segment = (cache_shared_segment *) mmap(NULL, s->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(s->segment == MAP_FAILED) {
+        s->segment = NULL;
+        return(-1);
+    }
+
+    s->sets = (cache_shared_set *) (s->segment + 1);
+    s->segment->sets = sets;
+    s->segment->ways = CART_CACHE_SHARED_WAYS;
+    s->segment->frame_size = CART_FRAME_SIZE;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for(i = 0; i < sets; i++) { //pages are zero, so every way starts empty
+        pthread_mutex_init(&s->sets[i].lock, &attr);
+    }
+    pthread_mutexattr_destroy(&attr);
+    __atomic_store_n(&s->segment->magic, CART_CACHE_SHARED_MAGIC, __ATOMIC_RELEASE); //segment is ready
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_open
+// Description  : Maps a segment another process created, waiting for it to
+//                be set up. Its size is its own; the frames asked for only
+//                matter to the process that creates it.
+//
+// Inputs       : s - the tier
+//                fd - the segment
+// Outputs      : 0 if successful, -1 if failure
+
+int shared_open(cache_shared *s, int fd) {
+    struct stat st; //size of segment
+    int tries; //looks at segment
+
+    for(tries = 0; tries < CART_CACHE_SHARED_WAIT_TRIES; tries++) { //creator may not have sized it yet
+        if(fstat(fd, &st) == -1) return(-1);
+        if((size_t)st.st_size > sizeof(cache_shared_segment)) break;
+        usleep(CART_CACHE_SHARED_WAIT_US);
+    }
+    if(tries == CART_CACHE_SHARED_WAIT_TRIES) return(-1);
+
+    s->length = st.st_size;
+    s->segment = (cache_shared_segment *) mmap(NULL, s->length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(s->segment == MAP_FAILED) {
+        s->segment = NULL;
+        return(-1);
+    }
+    for(tries = 0; tries < CART_CACHE_SHARED_WAIT_TRIES; tries++) { //creator may still be setting up sets
+        if(__atomic_load_n(&s->segment->magic, __ATOMIC_ACQUIRE) == CART_CACHE_SHARED_MAGIC) break;
+        usleep(CART_CACHE_SHARED_WAIT_US);
+    }
+    if(tries == CART_CACHE_SHARED_WAIT_TRIES || s->segment->ways != CART_CACHE_SHARED_WAYS || s->segment->frame_size != CART_FRAME_SIZE ||
+        s->length < sizeof(cache_shared_segment) + (size_t)s->segment->sets * sizeof(cache_shared_set)) { //not a segment of this driver
+        munmap(s->segment, s->length);
+        s->segment = NULL;
+        return(-1);
+    }
+    s->sets = (cache_shared_set *) (s->segment + 1);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_session
+// Description  : Gets an id for carts of unknown generation, from the
+//                process and the time of attach. The top bit keeps it apart
+//                from the small generations callers count up.
+//
+// Inputs       : none
+// Outputs      : the id
+
+uint64_t shared_session(void) {
+    struct timespec now; //time of attach
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return((1ULL << 63) | (((uint64_t)getpid() << 32) ^ ((uint64_t)now.tv_sec * 1000000000u + now.tv_nsec)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_attach
+// Description  : Attach to the shared memory segment of the tier, creating
+//                it if no process on the host has yet. The segment outlives
+//                the process, so the next driver of the same generation
+//                finds the frames. With an unknown generation (0) the carts
+//                may have been formatted since any frame was stored, so
+//                only frames this attach stores are used.
+//
+// Inputs       : s - the tier
+//                name - name of segment, as for shm_open
+//                frames - frames segment holds, if it is created
+//                generation - contents of the carts, 0 if unknown
+// Outputs      : 0 if successful, -1 if failure
+
+int shared_attach(cache_shared *s, const char *name, int32_t frames, uint64_t generation) {
+    int fd, response; //segment, response from setting it up
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd != -1) { //first process, set it up
+        response = shared_create(s, fd, frames);
+        if(response == -1) shm_unlink(name); //don't leave a segment nobody can use
+    } else if(errno == EEXIST && (fd = shm_open(name, O_RDWR, 0600)) != -1) { //another process made it
+        response = shared_open(s, fd);
+    } else {
+        response = -1;
+    }
+    if(fd != -1) close(fd); //mapping stays
+    if(response == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure attaching shared cache segment [%s].", name);
+        return(-1);
+    }
+
+    s->generation = (generation != 0) ? generation : shared_session(); //stamp of this process's frames
+    s->hits = 0;
+    s->misses = 0;
+    s->stores = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_detach
+// Description  : Unmap the shared memory segment, leaving it for the other
+//                processes
+//
+// Inputs       : s - the tier
+// Outputs      : none
+
+void shared_detach(cache_shared *s) {
+    if(s->segment == NULL) return; //tier not used
+    munmap(s->segment, s->length);
+    s->segment = NULL;
+    s->sets = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_store
+// Description  : Stores the current copy of a frame, replacing an older
+//                copy or else the least recently used way of its set
+//
+// Inputs       : s - the tier
+//                key - index key of the frame
+//                data - CART_FRAME_SIZE bytes of the frame
+// Outputs      : none
+
+void shared_store(cache_shared *s, uint32_t key, const void *data) {
+    cache_shared_set *set; //set of frame
+    int way, i; //way to write, iterator
+
+    if(s->segment == NULL) return; //tier not used
+    set = shared_set_of(s, key);
+    if(shared_lock(set) == -1) return; //set is lost, frame just isn't shared
+    way = shared_find(set, key);
+    for(i = 0; way == -1 && i < CART_CACHE_SHARED_WAYS; i++) { //else an empty way
+        if(set->keys[i] == 0) way = i;
+    }
+    if(way == -1) { //set is full, take oldest way
+        way = 0;
+        for(i = 1; i < CART_CACHE_SHARED_WAYS; i++) {
+            if(set->stamps[i] < set->stamps[way]) way = i;
+        }
+    }
+    set->keys[way] = key + 1;
+    set->gens[way] = s->generation;
+    set->stamps[way] = ++set->clock;
+    memcpy(set->data[way], data, CART_FRAME_SIZE);
+    pthread_mutex_unlock(&set->lock);
+    __atomic_fetch_add(&s->stores, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_load
+// Description  : Copies a frame out of the segment, if some process of the
+//                same generation stored it. The copy stays for the other
+//                processes; a copy of another generation is left for the
+//                processes of that generation.
+//
+// Inputs       : s - the tier
+//                key - index key of the frame
+//                buf - CART_FRAME_SIZE bytes to copy the frame into
+// Outputs      : 0 if found, -1 if not
+
+int shared_load(cache_shared *s, uint32_t key, void *buf) {
+    cache_shared_set *set; //set of frame
+    int way; //way of frame
+
+    if(s->segment == NULL) return(-1); //tier not used
+    set = shared_set_of(s, key);
+    if(shared_lock(set) == -1) return(-1);
+    way = shared_find(set, key);
+    if(way != -1 && set->gens[way] != s->generation) way = -1; //carts it came from may not hold it
+    if(way != -1) {
+        set->stamps[way] = ++set->clock; //used again
+        memcpy(buf, set->data[way], CART_FRAME_SIZE);
+    }
+    pthread_mutex_unlock(&set->lock);
+    __atomic_fetch_add((way == -1) ? &s->misses : &s->hits, 1, __ATOMIC_RELAXED);
+    return((way == -1) ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shared_drop
+// Description  : Forgets the copy of a frame, for every process
+//
+// Inputs       : s - the tier
+//                key - index key of the frame
+// Outputs      : none
+
+void shared_drop(cache_shared *s, uint32_t key) {
+    cache_shared_set *set; //set of frame
+    int way; //way of frame
+
+    if(s->segment == NULL) return; //tier not used
+    set = shared_set_of(s, key);
+    if(shared_lock(set) == -1) return;
+    way = shared_find(set, key);
+    if(way != -1) set->keys[way] = 0;
+    pthread_mutex_unlock(&set->lock);
+}
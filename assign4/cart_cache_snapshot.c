@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_cache_snapshot.c
+//  Description    : This is the warm restart snapshot of the cache of the
+//                   CART driver. On close the resident frames are written to
+//                   a local file oldest first, optionally with their data
+//                   and a checksum of each frame. On init the data is put
+//                   back if the carts still hold what the cache mirrored
+//                   (same generation); otherwise only the keys are kept, in
+//                   cart order, for the driver to prefetch from the carts.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// Project includes
+#include <cart_cache.h>
+#include <cmpsc311_log.h>
+// Defines
+#define SNAPSHOT_MAGIC 0x31534343 // "CCS1"
+#define SNAPSHOT_VERSION 2 // Layout of snapshot file
+#define SNAPSHOT_PINNED 0x1 // Frame was pinned
+
+//SNAPSHOT HEADER STRUCT
+typedef struct snapshot_header { //start of snapshot file
+    uint32_t magic; //SNAPSHOT_MAGIC
+    uint32_t version; //SNAPSHOT_VERSION
+    uint32_t frame_size; //CART_FRAME_SIZE of writer
+    uint32_t count; //frames in snapshot
+    uint32_t payloads; //1 if frame data follows each key
+    uint32_t reserved; //0
+    uint64_t generation; //cart contents cache mirrored
+} snapshot_header;
+
+//SNAPSHOT ENTRY STRUCT
+typedef struct snapshot_entry { //one frame, data follows if payloads
+    uint32_t key; //index key of frame
+    uint32_t checksum; //checksum of key and data, 0 without data
+    uint32_t flags; //SNAPSHOT_PINNED
+    uint32_t reserved; //0
+} snapshot_entry;
+
+// Function Declarations
+uint32_t snapshot_checksum(uint32_t, const char*); //checksums frame
+int write_slot(FILE*, Cache*, int32_t, int); //writes one frame
+int compare_key(const void*, const void*); //orders keys by cart then frame
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : snapshot_checksum
+// Description  : FNV-1a checksum of a frame and its key, so data written
+//                for one frame is never restored as another
+//
+// Inputs       : key - index key of frame
+//                data - CART_FRAME_SIZE bytes of frame
+// Outputs      : checksum
+
+uint32_t snapshot_checksum(uint32_t key, const char *data) {
+    uint32_t sum = 2166136261u ^ key; //offset basis, seeded with key
+    int i; //byte
+
+    for(i = 0; i < CART_FRAME_SIZE; i++) {
+        sum ^= (uint8_t)data[i];
+        sum *= 16777619u;
+    }
+    return(sum | 1); //never 0, which means no data
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_slot
+// Description  : Writes one resident frame to the snapshot
+//
+// Inputs       : f - the snapshot file
+//                c - the shard
+//                slot - the slot of the frame
+//                payloads - 1 to write the frame data
+// Outputs      : 0 if successful, -1 if failure
+
+int write_slot(FILE *f, Cache *c, int32_t slot, int payloads) {
+    snapshot_entry entry; //entry of frame
+    char *data = &c->payload[(size_t)slot * CART_FRAME_SIZE]; //frame data
+
+    entry.key = CART_CACHE_KEY(c->nodes[slot].cart, c->nodes[slot].frame);
+    entry.checksum = payloads ? snapshot_checksum(entry.key, data) : 0;
+    entry.flags = (c->nodes[slot].flags & CART_CACHE_SLOT_PINNED) ? SNAPSHOT_PINNED : 0;
+    entry.reserved = 0;
+    if(fwrite(&entry, sizeof(entry), 1, f) != 1) return(-1);
+    if(payloads && fwrite(data, CART_FRAME_SIZE, 1, f) != 1) return(-1);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : save_cart_cache_snapshot
+// Description  : Writes every resident frame to the snapshot file, oldest
+//                first so putting them back in order rebuilds recency. The
+//                lists a policy keeps slots on are walked in list order (the
+//                FIFO or recent list before the main or frequent one); slots
+//                on no list, as with CLOCK, and pinned slots follow in slot
+//                order, pinned ones marked so. The file is written aside and
+//                renamed, so a crash never leaves half a snapshot.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int save_cart_cache_snapshot(void) {
+    snapshot_header header; //start of file
+    char *tmp; //file written aside
+    uint8_t *written; //slots already written
+    int i, l, ret = 0; //shard, list, result
+    int32_t slot; //slot
+    Cache *c; //shard
+    FILE *f; //snapshot file
+
+    if(cache.snapshot_path == NULL || cache.shards == NULL) return(0); //no snapshot kept
+    if((tmp = (char *) malloc(strlen(cache.snapshot_path) + 5)) == NULL) return(-1);
+    sprintf(tmp, "%s.tmp", cache.snapshot_path);
+    if((f = fopen(tmp, "wb")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing cache snapshot [%s].", tmp);
+        free(tmp);
+        return(-1);
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.frame_size = CART_FRAME_SIZE;
+    header.payloads = cache.snapshot_payloads;
+    header.generation = cache.generation;
+    for(i = 0; i < cache.shard_count; i++) header.count += cache.shards[i].current_cache_size + cache.shards[i].pinned; //pinned slots are written too
+    if(fwrite(&header, sizeof(header), 1, f) != 1) ret = -1;
+
+    for(i = 0; ret == 0 && i < cache.shard_count; i++) { //each shard, under its lock
+        c = &cache.shards[i];
+        if(c->nodes == NULL) continue;
+        if((written = (uint8_t *) calloc(c->capacity, 1)) == NULL) {
+            ret = -1;
+            break;
+        }
+        pthread_mutex_lock(&c->lock);
+        for(l = 0; ret == 0 && l < CART_CACHE_LISTS; l++) { //lists of slots, oldest first
+            if(!(c->policy->slot_lists & (1 << l))) continue;
+            for(slot = c->lists[l].head; ret == 0 && slot != CART_CACHE_NONE; slot = c->nodes[slot].prev) {
+                written[slot] = 1;
+                ret = write_slot(f, c, slot, cache.snapshot_payloads);
+            }
+        }
+        for(slot = 0; ret == 0 && slot < c->capacity; slot++) { //slots on no list
+            if((c->nodes[slot].flags & CART_CACHE_SLOT_USED) && !written[slot]) ret = write_slot(f, c, slot, cache.snapshot_payloads);
+        }
+        pthread_mutex_unlock(&c->lock);
+        free(written);
+    }
+
+    if(fclose(f) != 0) ret = -1;
+    if(ret == 0 && rename(tmp, cache.snapshot_path) == -1) ret = -1;
+    if(ret == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing cache snapshot [%s].", cache.snapshot_path);
+        remove(tmp);
+    }
+    free(tmp);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_key
+// Description  : Orders keys by cart then frame, the order that loads each
+//                cart once
+//
+// Inputs       : a, b - the keys
+// Outputs      : <0, 0 or >0 as for qsort
+
+int compare_key(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b; //keys to compare
+
+    return((x > y) - (x < y)); //cart is in high bits
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_cart_cache_snapshot
+// Description  : Reads the snapshot file into a freshly initialized cache.
+//                Frames are put back with their data only if the snapshot
+//                has data, the generation matches and is known (not 0), and
+//                the checksum of the frame is right; pinned frames are pinned
+//                again while the pin budget lasts. Otherwise the keys are
+//                kept, sorted into cart order, for cart_cache_warm_keys.
+//
+// Inputs       : none
+// Outputs      : 0 if successful (or no snapshot), -1 if failure
+
+int load_cart_cache_snapshot(void) {
+    snapshot_header header; //start of file
+    snapshot_entry entry; //each frame
+    char data[CART_FRAME_SIZE]; //frame data
+    uint32_t i, restored = 0, bad = 0; //entry, frames put back, frames with bad checksum
+    int trusted; //whether frame data may be put back
+    FILE *f; //snapshot file
+
+    free(cache.warm_keys); //keys of an earlier init never prefetched
+    cache.warm_keys = NULL;
+    cache.warm_count = 0;
+    if(cache.snapshot_path == NULL || (f = fopen(cache.snapshot_path, "rb")) == NULL) return(0); //nothing to restore
+    if(fread(&header, sizeof(header), 1, f) != 1 || header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+        header.frame_size != CART_FRAME_SIZE || header.count > CART_MAX_CARTRIDGES * CART_CARTRIDGE_SIZE) { //never more frames than the carts hold
+        logMessage(LOG_ERROR_LEVEL, "Ignoring bad cache snapshot [%s].", cache.snapshot_path);
+        fclose(f);
+        return(0);
+    }
+
+    trusted = header.payloads && header.generation != 0 && header.generation == cache.generation;
+    cache.warm_keys = trusted ? NULL : (uint32_t *) malloc(sizeof(uint32_t) * ((size_t)header.count + 1));
+    cache.warm_count = 0;
+    for(i = 0; i < header.count; i++) { //each frame, oldest first
+        if(fread(&entry, sizeof(entry), 1, f) != 1) break; //cut short
+        if(header.payloads && fread(data, CART_FRAME_SIZE, 1, f) != 1) break;
+        if(trusted) { //put data back
+            if(entry.checksum != snapshot_checksum(entry.key, data)) {
+                bad++;
+                continue;
+            }
+            if(!(entry.flags & SNAPSHOT_PINNED) || pin_cart_cache(CART_CACHE_KEY_CART(entry.key), CART_CACHE_KEY_FRAME(entry.key), data) == -1) {
+                put_cart_cache(CART_CACHE_KEY_CART(entry.key), CART_CACHE_KEY_FRAME(entry.key), data); //unpinned, or over budget
+            }
+            restored++;
+        } else if(cache.warm_keys != NULL && (uint32_t)cache.warm_count < header.count) { //keep key to prefetch
+            cache.warm_keys[cache.warm_count++] = entry.key;
+        }
+    }
+    fclose(f);
+
+    if(cache.warm_keys != NULL) qsort(cache.warm_keys, cache.warm_count, sizeof(uint32_t), compare_key); //cart order
+    logMessage(LOG_INFO_LEVEL, "Cache snapshot [%s]: %u frames restored, %u keys to prefetch, %u bad checksums.",
+        cache.snapshot_path, restored, cache.warm_count, bad);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_cache_warm_keys
+// Description  : Hands the keys of a snapshot that could not be restored
+//                with data to the driver, in cart order, and forgets them
+//
+// Inputs       : keys - where to put the keys
+//                max - most keys to put
+// Outputs      : number of keys put
+
+int cart_cache_warm_keys(uint32_t *keys, int max) {
+    int count = (cache.warm_count < max) ? cache.warm_count : max; //keys to hand over
+
+    if(cache.warm_keys == NULL) return(0); //nothing to prefetch
+    memcpy(keys, cache.warm_keys, sizeof(uint32_t) * count);
+    free(cache.warm_keys);
+    cache.warm_keys = NULL;
+    cache.warm_count = 0;
+    return(count);
+}
@@ -0,0 +1,193 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_cache_tier2.c
+//  Description    : This is the second tier of the cache of the CART driver,
+//                   a victim cache in a local file. Frames evicted from
+//                   memory are written to a slot of the file, and a memory
+//                   miss reads them back instead of going to the cart. A
+//                   frame lives in only one tier at a time: reading it back
+//                   frees its slot in the file.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+// Project includes
+#include <cart_cache.h>
+#include <cmpsc311_log.h>
+// Defines
+
+// Function Declarations
+void tier2_forget(cache_tier2*, int32_t); //frees slot of file
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tier2_init
+// Description  : Create the file and index of the second tier
+//
+// Inputs       : t - the tier
+//                path - file to keep frames in
+//                frames - number of frames file holds
+// Outputs      : 0 if successful, -1 if failure
+
+int tier2_init(cache_tier2 *t, const char *path, int32_t frames) {
+    int32_t i; //slot
+
+    t->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600); //old contents mean nothing without the index
+    if(t->fd == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening cache tier file [%s].", path);
+        return(-1);
+    }
+    if(ftruncate(t->fd, (off_t)frames * CART_FRAME_SIZE) == -1) { //reserve the whole file
+        close(t->fd);
+        t->fd = -1;
+        return(-1);
+    }
+
+    t->frames = frames;
+    t->keys = (uint32_t *) calloc(frames, sizeof(uint32_t)); //every slot empty
+    t->free_slots = (int32_t *) malloc(sizeof(int32_t) * frames);
+    if(t->keys == NULL || t->free_slots == NULL || index_init(&t->index, frames) == -1 || pthread_mutex_init(&t->lock, NULL) != 0) {
+        close(t->fd);
+        free(t->keys);
+        free(t->free_slots);
+        t->keys = NULL;
+        t->free_slots = NULL;
+        return(-1);
+    }
+    for(i = 0; i < frames; i++) t->free_slots[i] = frames - 1 - i; //lowest slots first
+    t->free_count = frames;
+    t->hand = 0;
+    t->hits = 0;
+    t->misses = 0;
+    t->writes = 0;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tier2_close
+// Description  : Close and remove the file of the second tier
+//
+// Inputs       : t - the tier
+//                path - file frames were kept in
+// Outputs      : none
+
+void tier2_close(cache_tier2 *t, const char *path) {
+    if(t->keys == NULL) return; //tier not used
+    close(t->fd);
+    unlink(path); //frames are not kept across runs
+    pthread_mutex_destroy(&t->lock);
+    free(t->keys);
+    free(t->free_slots);
+    index_free(&t->index);
+    t->keys = NULL;
+    t->free_slots = NULL;
+    t->fd = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tier2_forget
+// Description  : Frees a slot of the file, the tier is locked
+//
+// Inputs       : t - the tier
+//                slot - the slot
+// Outputs      : none
+
+void tier2_forget(cache_tier2 *t, int32_t slot) {
+    index_remove(&t->index, t->keys[slot] - 1); //key no longer in file
+    t->keys[slot] = 0;
+    t->free_slots[t->free_count++] = slot; //slot can be written again
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tier2_store
+// Description  : Writes a frame evicted from memory to the file. With no
+//                free slot the hand overwrites the oldest written ones.
+//
+// Inputs       : t - the tier
+//                key - index key of the frame
+//                data - CART_FRAME_SIZE bytes of the frame
+// Outputs      : none
+
+void tier2_store(cache_tier2 *t, uint32_t key, const void *data) {
+    int32_t slot; //slot to write
+
+    if(t->keys == NULL) return; //tier not used
+    pthread_mutex_lock(&t->lock);
+    slot = index_find(&t->index, key);
+    if(slot == CART_CACHE_NONE) { //if frame has no slot yet
+        if(t->free_count == 0) tier2_forget(t, t->hand); //every slot is used, evict the one under the hand
+        slot = t->free_slots[--t->free_count];
+        t->keys[slot] = key + 1;
+        index_insert(&t->index, key, slot);
+        t->hand = (slot + 1) % t->frames; //oldest write is just past newest
+    }
+    if(pwrite(t->fd, data, CART_FRAME_SIZE, (off_t)slot * CART_FRAME_SIZE) != CART_FRAME_SIZE) { //if frame can't be written
+        tier2_forget(t, slot);
+    } else {
+        t->writes++;
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tier2_load
+// Description  : Reads a frame back from the file and frees its slot, since
+//                the frame goes back into memory
+//
+// Inputs       : t - the tier
+//                key - index key of the frame
+//                buf - CART_FRAME_SIZE bytes to read frame into
+// Outputs      : 0 if frame was read, -1 if not in tier
+
+int tier2_load(cache_tier2 *t, uint32_t key, void *buf) {
+    int32_t slot; //slot of frame
+    int ret = -1; //result
+
+    if(t->keys == NULL) return(-1); //tier not used
+    pthread_mutex_lock(&t->lock);
+    slot = index_find(&t->index, key);
+    if(slot != CART_CACHE_NONE) {
+        if(pread(t->fd, buf, CART_FRAME_SIZE, (off_t)slot * CART_FRAME_SIZE) == CART_FRAME_SIZE) ret = 0;
+        tier2_forget(t, slot); //frame is in memory again, or unreadable
+    }
+    if(ret == 0) {
+        t->hits++;
+    } else {
+        t->misses++;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tier2_drop
+// Description  : Forgets the copy of a frame in the file, when the frame is
+//                deleted or written anew in memory
+//
+// Inputs       : t - the tier
+//                key - index key of the frame
+// Outputs      : none
+
+void tier2_drop(cache_tier2 *t, uint32_t key) {
+    int32_t slot; //slot of frame
+
+    if(t->keys == NULL) return; //tier not used
+    pthread_mutex_lock(&t->lock);
+    slot = index_find(&t->index, key);
+    if(slot != CART_CACHE_NONE) tier2_forget(t, slot);
+    pthread_mutex_unlock(&t->lock);
+}
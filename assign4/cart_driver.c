@@ -17,14 +17,55 @@
 #include <cart_controller.h>
 #include <cart_cache.h>
 #include <cart_network.h>
+#include <cart_trace.h>
+#include <cart_prefetch.h>
+#include <cart_lease.h>
+#include <cmpsc311_log.h>
 //
 // Implementation
 
+//FRAME ORDER STRUCT
+typedef struct frame_order { //frame of a file waiting to be read
+    int16_t cart; //cart frame is in
+    int16_t frame; //frame in cart
+    int index; //index of frame in read
+} frame_order;
+
 // Function Declarations
 CartXferRegister generate_encoded_opcode(CartXferRegister, CartXferRegister, CartXferRegister, CartXferRegister); //generates opcode
 int hash(char*); //hashed file path
 int extract_opcode_response(CartXferRegister); //extracts opcode
 int run_opcode(CartXferRegister, void*); //runs opcode
+int frame_payload(File*); //bytes used per frame
+int free_frames(int); //counts free frames in cart
+int find_free_frame(int); //finds free frame in cart
+int allocate_frame(File*, int); //allocates frame for file
+void release_frame(int16_t, int16_t); //gives frame back to free map
+int next_map_frame(int, int, int); //finds next free or used frame in cart
+int find_free_run(int, int); //finds contiguous free frames in cart
+int allocate_run(File*, int, int); //allocates contiguous frames for file
+int grow_file(File*, int, int); //allocates frame for growing file
+void release_reserved(File*); //releases frames reserved past end of file
+int compare_frame_order(const void*, const void*); //sorts frames by cart then frame
+int load_frames(File*, int, int, char*); //reads several frames of file
+int layout_ldcarts(File*); //estimates LDCARTs to read file
+int defrag_file(File*); //moves file into contiguous frames
+int read_cart_frame(int16_t, int16_t, char*); //reads frame from cart
+int write_cart_frame(int16_t, int16_t, char*); //writes frame to cart
+int load_frame(int16_t, int16_t, char*, int); //reads frame from cache or cart
+int store_frame(int16_t, int16_t, char*, int); //writes frame to cart and cache
+int write_frame_in_place(int16_t, int16_t, int, char*, int, int); //writes part of frame in its cache slot
+int write_frame_around(int16_t, int16_t, int, char*, int); //writes part of frame without caching it
+int write_allocates(File*); //whether writes of file cache the frames
+int frame_cacheable(int16_t, int16_t, int); //whether frame may be cached under its lease
+int frame_writable(int16_t, int16_t); //whether frame may be written under its lease
+int warm_cache(void); //prefetches frames of cache snapshot
+int prefetch_frames(File*, int, int); //reads frames of file into cache
+void drop_frames(File*, int, int); //drops frames of file from cache
+void read_ahead(File*, int, int); //reads ahead of a sequential read
+void reset_advice(File*); //forgets access pattern of file
+void record_access(int16_t, int16_t, uint8_t); //traces and learns from a frame access
+void predict_frames(int); //prefetches frames predicted to follow last access
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -108,6 +149,681 @@ int hash(char *str) {
     return hash; //return hash in range of files_size
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : frame_payload
+// Description  : Gets number of file bytes stored in each frame for the
+//                file's on-cartridge format
+//
+// Inputs       : File
+// Outputs      : bytes of file data per frame
+
+int frame_payload(File *file) {
+    if(file->format == CART_FORMAT_V1) { //if file uses original layout
+        return(CART_FRAME_SIZE - 1); //last byte of each frame is unused
+    }
+    return(CART_FRAME_SIZE); //full layout uses entire frame
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_frames
+// Description  : Counts the free frames left in a cart
+//
+// Inputs       : cart
+// Outputs      : number of free frames
+
+int free_frames(int cart) {
+    int i, count = 0; //iterator and free frame count
+
+    for(i = 0; i < CART_MAP_WORDS; i++) { //go word by word through free map
+        count += __builtin_popcountll(file_system.free_map[cart][i]); //each set bit is a free frame
+    }
+    return(count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_free_frame
+// Description  : Finds the lowest free frame in a cart
+//
+// Inputs       : cart
+// Outputs      : frame if found, -1 if cart is full
+
+int find_free_frame(int cart) {
+    int i; //iterator
+
+    for(i = 0; i < CART_MAP_WORDS; i++) { //go word by word through free map
+        if(file_system.free_map[cart][i] != 0) { //if any frame in word is free
+            return(i * 64 + __builtin_ctzll(file_system.free_map[cart][i])); //lowest set bit is the frame
+        }
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocate_frame
+// Description  : Gives a free frame to a file, preferring the cart that is
+//                already loaded, then the cart holding the file's previous
+//                frame, then the lowest cart with space
+//
+// Inputs       : File and index of frame in file
+// Outputs      : 0 if successful, -1 if failure
+
+int allocate_frame(File *file, int index) {
+    int cart = -1, frame = -1, i; //cart and frame to use, iterator
+
+    if(file_system.last_cart_loaded >= 0 && file_system.last_cart_loaded < CART_MAX_CARTRIDGES) { //try loaded cart first, no LDCART needed
+        cart = file_system.last_cart_loaded;
+        frame = find_free_frame(cart);
+    }
+    if(frame == -1 && index > 0 && file->data[index-1].cart != -1) { //then keep file together
+        cart = file->data[index-1].cart;
+        frame = find_free_frame(cart);
+    }
+    for(i = 0; frame == -1 && i < CART_MAX_CARTRIDGES; i++) { //then any cart with space
+        cart = i;
+        frame = find_free_frame(cart);
+    }
+    if(frame == -1) { //if all carts are full
+        return(-1); //no space left
+    }
+
+    file_system.free_map[cart][frame / 64] &= ~(1ULL << (frame % 64)); //mark frame as used
+    file->data[index].cart = cart; //give cart to file
+    file->data[index].frame = frame; //give frame to file
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_frame
+// Description  : Gives a frame back to the free map and drops it from cache
+//
+// Inputs       : cart and frame
+// Outputs      : none
+
+void release_frame(int16_t cart, int16_t frame) {
+    file_system.free_map[cart][frame / 64] |= (1ULL << (frame % 64)); //mark frame as free
+    file_system.visited[cart][frame] = 0; //next owner sees a zeroed frame
+    delete_cart_cache(cart, frame); //cached copy is no longer valid
+    cart_trace_record(cart, frame, CART_TRACE_FREE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : next_map_frame
+// Description  : Finds the first frame at or after "frame" in a cart that is
+//                free (or used)
+//
+// Inputs       : cart, frame to start at, 1 to look for free or 0 for used
+// Outputs      : frame if found, CART_CARTRIDGE_SIZE if none
+
+int next_map_frame(int cart, int frame, int want_free) {
+    int word = frame / 64; //word holding frame
+    uint64_t bits; //bits of word still to check
+
+    while(word < CART_MAP_WORDS) { //go word by word through free map
+        bits = want_free ? file_system.free_map[cart][word] : ~file_system.free_map[cart][word]; //set bits are what we want
+        if(word == frame / 64) bits &= ~0ULL << (frame % 64); //skip frames before start
+        if(bits != 0) return(word * 64 + __builtin_ctzll(bits)); //lowest set bit is the frame
+        word++;
+    }
+    return(CART_CARTRIDGE_SIZE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : find_free_run
+// Description  : Finds "count" free frames in a row in a cart
+//
+// Inputs       : cart, number of frames
+// Outputs      : first frame of run if found, -1 if none
+
+int find_free_run(int cart, int count) {
+    int start, end = 0; //start and end of current run
+
+    if(free_frames(cart) < count) return(-1); //not enough space in cart at all
+
+    while(end < CART_CARTRIDGE_SIZE) { //go run by run
+        start = next_map_frame(cart, end, 1); //start of next free run
+        if(start == CART_CARTRIDGE_SIZE) break; //no more free frames
+        end = next_map_frame(cart, start, 0); //end of free run
+        if(end - start >= count) return(start); //run is long enough
+    }
+    return(-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocate_run
+// Description  : Gives a file "count" frames in a row on one cart, starting
+//                at frame "index" of the file. Prefers the loaded cart, then
+//                the cart holding the file's previous frame.
+//
+// Inputs       : File, index of first frame in file, number of frames
+// Outputs      : 0 if successful, -1 if no cart has a long enough run
+
+int allocate_run(File *file, int index, int count) {
+    int cart = -1, frame = -1, i; //cart and first frame to use, iterator
+
+    if(file_system.last_cart_loaded >= 0 && file_system.last_cart_loaded < CART_MAX_CARTRIDGES) { //try loaded cart first
+        cart = file_system.last_cart_loaded;
+        frame = find_free_run(cart, count);
+    }
+    if(frame == -1 && index > 0 && file->data[index-1].cart != -1) { //then keep file together
+        cart = file->data[index-1].cart;
+        frame = find_free_run(cart, count);
+    }
+    for(i = 0; frame == -1 && i < CART_MAX_CARTRIDGES; i++) { //then any cart with a long enough run
+        cart = i;
+        frame = find_free_run(cart, count);
+    }
+    if(frame == -1) { //if no cart has room
+        return(-1);
+    }
+
+    for(i = 0; i < count; i++) { //give each frame to file
+        file_system.free_map[cart][(frame+i) / 64] &= ~(1ULL << ((frame+i) % 64)); //mark frame as used
+        file->data[index+i].cart = cart;
+        file->data[index+i].frame = frame + i;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : grow_file
+// Description  : Allocates frame "index" of a file that is being written.
+//                Once a file grows past its first frame, a run of frames as
+//                long as the file already is (at least the rest of the
+//                write) is reserved on one cart, so it stays contiguous.
+//
+// Inputs       : File, index of frame in file, frames left to write
+// Outputs      : 0 if successful, -1 if failure
+
+int grow_file(File *file, int index, int needed) {
+    int run = index, i; //reserve as many frames as file has, iterator
+
+    if(run < needed) run = needed; //at least cover this write
+    if(run > CART_PREALLOC_MAX_FRAMES) run = CART_PREALLOC_MAX_FRAMES; //cap reservation
+    if(run > CART_CARTRIDGE_SIZE - index) run = CART_CARTRIDGE_SIZE - index; //stay inside file
+    for(i = 1; i < run; i++) { //stop at first frame already allocated, so none is replaced
+        if(file->data[index+i].cart != -1) run = i;
+    }
+
+    if(run > 1 && allocate_run(file, index, run) == 0) { //try to reserve contiguous run
+        return(0);
+    }
+    return(allocate_frame(file, index)); //otherwise take any frame
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_reserved
+// Description  : Gives back frames reserved past the end of a file that
+//                weren't asked for with cart_fallocate
+//
+// Inputs       : File
+// Outputs      : none
+
+void release_reserved(File *file) {
+    int payload = frame_payload(file); //bytes of file data per frame
+    int32_t keep = (file->size > file->reserved) ? file->size : file->reserved; //bytes that need frames
+    int i; //iterator
+
+    for(i = (keep + payload - 1) / payload; i < CART_CARTRIDGE_SIZE; i++) { //frames past what is kept
+        if(file->data[i].cart != -1) {
+            release_frame(file->data[i].cart, file->data[i].frame);
+            file->data[i].cart = -1;
+            file->data[i].frame = -1;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_cart_frame
+// Description  : Reads a whole frame from the cart, without the cache
+//
+// Inputs       : cart, frame, and buffer of CART_FRAME_SIZE bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int read_cart_frame(int16_t cart, int16_t frame, char *buf) {
+    int response; //response from cart
+
+    if(file_system.last_cart_loaded != cart) { //checks if cart is open
+        response = run_opcode(generate_encoded_opcode(CART_OP_LDCART, 0, cart, 0), NULL); //opens cart
+        if(response == -1) return(-1); //if failed, return -1
+        file_system.last_cart_loaded = cart; //sets last cart loaded
+    }
+
+    return(run_opcode(generate_encoded_opcode(CART_OP_RDFRME, 0, 0, frame), buf)); //gets frame
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_cart_frame
+// Description  : Writes a whole frame to the cart, without the cache
+//
+// Inputs       : cart, frame, and buffer of CART_FRAME_SIZE bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int write_cart_frame(int16_t cart, int16_t frame, char *buf) {
+    int response; //response from cart
+
+    if(file_system.last_cart_loaded != cart) { //checks if cart is open
+        response = run_opcode(generate_encoded_opcode(CART_OP_LDCART, 0, cart, 0), NULL); //opens cart
+        if(response == -1) return(-1); //if failed, return -1
+        file_system.last_cart_loaded = cart; //sets last cart loaded
+    }
+
+    response = run_opcode(generate_encoded_opcode(CART_OP_WRFRME, 0, 0, frame), buf); //writes frame
+    if(response == -1) return(-1); //checks if successful
+    file_system.visited[cart][frame] = 1; //mark data as visited
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_frame
+// Description  : Reads a whole frame from the cache, or from the cart if it
+//                isn't cached
+//
+// Inputs       : cart, frame, buffer of CART_FRAME_SIZE bytes, and cache
+//                partition of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int load_frame(int16_t cart, int16_t frame, char *buf, int part) {
+    int cacheable; //whether frame may be cached
+
+    if(cart == -1) { //if frame was never allocated, it is a hole of zeros
+        memset(buf, 0, CART_FRAME_SIZE);
+        return(0);
+    }
+
+    record_access(cart, frame, CART_TRACE_READ);
+    cacheable = frame_cacheable(cart, frame, CART_LEASE_READ);
+    if(!file_system.visited[cart][frame]) { //if frame never written, it is zeroed
+        memset(buf, 0, CART_FRAME_SIZE); //no need to ask the cart, or a cache tier that may hold an older owner's frame
+        return(0);
+    }
+
+    if(cacheable && get_cart_cache_copy_part(cart, frame, buf, part) == 0) { //if data in cache, copy it into buf
+        return(0);
+    }
+
+    if(read_cart_frame(cart, frame, buf) == -1) return(-1); //get frame from cart
+    if(cacheable) put_cart_cache_part(cart, frame, buf, part); //add data to cache
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_frame_order
+// Description  : Orders frames by cart and then by frame, so a batch of reads
+//                loads each cart once and sweeps its frames in order
+//
+// Inputs       : two frame_order entries
+// Outputs      : negative, zero or positive like strcmp
+
+int compare_frame_order(const void *a, const void *b) {
+    const frame_order *x = (const frame_order *) a, *y = (const frame_order *) b; //entries to compare
+
+    if(x->cart != y->cart) return(x->cart - y->cart); //cart first
+    return(x->frame - y->frame); //then frame
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_frames
+// Description  : Reads "count" frames of a file starting at frame "first",
+//                fetching them in cart order instead of file order
+//
+// Inputs       : File, first frame, number of frames, buffer of
+//                count * CART_FRAME_SIZE bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int load_frames(File *file, int first, int count, char *frames) {
+    frame_order *order = (frame_order *) malloc(sizeof(frame_order) * count); //frames in fetch order
+    int i, response = 0; //iterator and response from cart
+
+    if(order == NULL) return(-1); //if allocation fails
+    for(i = 0; i < count; i++) { //collect frames of read
+        order[i].cart = file->data[first+i].cart;
+        order[i].frame = file->data[first+i].frame;
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(frame_order), compare_frame_order); //elevator order
+
+    for(i = 0; i < count && response == 0; i++) { //fetch each frame into its place
+        response = load_frame(order[i].cart, order[i].frame, &frames[order[i].index * CART_FRAME_SIZE], file->partition);
+    }
+
+    free(order); //release memory
+    return(response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : store_frame
+// Description  : Writes a whole frame to the cart and keeps the cache current
+//
+// Inputs       : cart, frame, buffer of CART_FRAME_SIZE bytes, and cache
+//                partition of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int store_frame(int16_t cart, int16_t frame, char *buf, int part) {
+    if(!frame_writable(cart, frame)) return(-1); //other clients drop their copies first
+    record_access(cart, frame, CART_TRACE_WRITE);
+    if(write_cart_frame(cart, frame, buf) == -1) return(-1); //send frame to cart
+    put_cart_cache_part(cart, frame, buf, part); //add data to cache
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_frame_in_place
+// Description  : Writes part (or all) of a frame by building it in its cache
+//                slot and sending it to the cart straight from there, so the
+//                frame is never copied into or out of the cache. Falls back
+//                to a stack buffer if the frame isn't cached.
+//
+// Inputs       : cart, frame, position in frame, data, bytes of data, and
+//                cache partition of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int write_frame_in_place(int16_t cart, int16_t frame, int offset, char *data, int length, int part) {
+    char read_in[CART_FRAME_SIZE]; //frame when it isn't cached
+    char *slot; //cache slot of frame
+    int valid = 1, response; //whether slot holds current frame, response from cart
+    int fresh = (length == CART_FRAME_SIZE) || !file_system.visited[cart][frame]; //no old data to read, a lower tier's copy can't be wanted
+
+    if(!frame_writable(cart, frame)) return(-1); //other clients drop their copies first
+    slot = reserve_cart_cache_part(cart, frame, fresh ? NULL : &valid, part); //whole or never written frame needs no old data
+    if(slot == NULL) { //frame not cached, merge in own buffer
+        if(length != CART_FRAME_SIZE && load_frame(cart, frame, read_in, part) == -1) return(-1); //get old frame
+        memcpy(&read_in[offset], data, length); //copies new data
+        return(store_frame(cart, frame, read_in, part));
+    }
+
+    if(length != CART_FRAME_SIZE) record_access(cart, frame, CART_TRACE_READ); //a merge reads the frame first
+    record_access(cart, frame, CART_TRACE_WRITE);
+    if(length != CART_FRAME_SIZE && !file_system.visited[cart][frame]) { //never written frames are zeroed
+        memset(slot, 0, CART_FRAME_SIZE);
+    } else if(!valid && read_cart_frame(cart, frame, slot) == -1) { //slot is new, old data must come from cart
+        commit_cart_cache(cart, frame, 0);
+        return(-1);
+    }
+    memcpy(&slot[offset], data, length); //copies new data into slot
+    response = write_cart_frame(cart, frame, slot); //send frame from slot
+    commit_cart_cache(cart, frame, response == 0); //slot only kept if cart has it too
+    return(response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_frame_around
+// Description  : Writes part (or all) of a frame straight to the cart,
+//                leaving the cache alone. The old frame comes from the
+//                cart, which is always current, and a copy in the second
+//                tier is dropped since it is now stale.
+//
+// Inputs       : cart, frame, position in frame, data, and bytes of data
+// Outputs      : 0 if successful, -1 if failure
+
+int write_frame_around(int16_t cart, int16_t frame, int offset, char *data, int length) {
+    char read_in[CART_FRAME_SIZE]; //frame being written
+
+    if(!frame_writable(cart, frame)) return(-1); //other clients drop their copies first
+    if(length != CART_FRAME_SIZE) { //a merge reads the frame first
+        record_access(cart, frame, CART_TRACE_READ);
+        if(!file_system.visited[cart][frame]) { //never written frames are zeroed
+            memset(read_in, 0, CART_FRAME_SIZE);
+        } else if(read_cart_frame(cart, frame, read_in) == -1) {
+            return(-1);
+        }
+    }
+    record_access(cart, frame, CART_TRACE_WRITE);
+    memcpy(&read_in[offset], data, length); //copies new data
+    delete_cart_cache(cart, frame); //no stale copy may stay behind
+    return(write_cart_frame(cart, frame, read_in));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_allocates
+// Description  : Decides whether writes of a file put frames in the cache,
+//                by the write mode of the file
+//
+// Inputs       : File
+// Outputs      : 1 if written frames are cached, 0 if writes go around
+
+int write_allocates(File *file) {
+    int mode = (file->write_mode == CART_WRITE_DEFAULT) ? file_system.write_mode : file->write_mode; //mode of file
+
+    if(mode == CART_WRITE_AROUND_SEQUENTIAL) return(file->write_run < CART_WRITE_AROUND_RUN); //cached until it is a stream
+    return(mode == CART_WRITE_ALLOCATE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : frame_cacheable
+// Description  : Decides whether a frame may be cached, by taking a lease on
+//                it when caches are kept coherent. Without the lease another
+//                client may change the frame, so any cached copy is dropped
+//                and the frame goes to and from the cart. Takes the lease
+//                before a slot is reserved, since answering the server may
+//                drop frames from the cache.
+//
+// Inputs       : cart, frame, and CART_LEASE_READ or CART_LEASE_WRITE
+// Outputs      : 1 if frame may be cached, 0 if not
+
+int frame_cacheable(int16_t cart, int16_t frame, int mode) {
+    if(file_system.lease_port == 0) return(1); //caches aren't shared
+    if(lease_acquire(cart, frame, mode) == 0) return(1);
+    delete_cart_cache(cart, frame); //copy can't be trusted
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : frame_writable
+// Description  : Takes the write lease on a frame before it is written,
+//                when caches are kept coherent, so every other client has
+//                dropped its copy first. A lost connection is made again
+//                once; without the lease the write must fail, since other
+//                clients would keep serving the old frame.
+//
+// Inputs       : cart and frame
+// Outputs      : 1 if frame may be written (and cached), 0 if not
+
+int frame_writable(int16_t cart, int16_t frame) {
+    if(file_system.lease_port == 0) return(1); //caches aren't shared
+    if(lease_acquire(cart, frame, CART_LEASE_WRITE) == 0) return(1);
+    if(lease_reconnect() == 0 && lease_acquire(cart, frame, CART_LEASE_WRITE) == 0) return(1); //connection was lost, lease again
+    delete_cart_cache(cart, frame); //copy can't be trusted
+    logMessage(LOG_ERROR_LEVEL, "No write lease on frame [%d:%d], write refused.", cart, frame);
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reset_advice
+// Description  : Forgets the access pattern of a file, as when it is opened
+//
+// Inputs       : File
+// Outputs      : none
+
+void reset_advice(File *file) {
+    file->advice = CART_ADVICE_NORMAL;
+    file->readahead = 0;
+    file->readahead_next = 0;
+    file->last_read_end = -1;
+    file->write_run = 0;
+    file->last_write_end = -1;
+    file->write_tail = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_frames
+// Description  : Reads frames of a file into the cache, in cart order and
+//                a window at a time. Frames past the end of the file are
+//                left alone.
+//
+// Inputs       : File, first frame, and number of frames
+// Outputs      : 0 if successful, -1 if failure
+
+int prefetch_frames(File *file, int first, int count) {
+    char *frames; //frames read, only the cache keeps them
+    int last = (file->size + frame_payload(file) - 1) / frame_payload(file); //frames holding file data
+    int chunk, response = 0; //frames in this window, response from cart
+
+    if(first + count > last) count = last - first;
+    if(count <= 0) return(0); //nothing to fetch
+    frames = (char *) malloc((size_t)CART_READAHEAD_MAX * CART_FRAME_SIZE);
+    if(frames == NULL) return(-1);
+    while(count > 0 && response == 0) { //a window at a time
+        chunk = (count < CART_READAHEAD_MAX) ? count : CART_READAHEAD_MAX;
+        response = load_frames(file, first, chunk, frames);
+        first += chunk;
+        count -= chunk;
+    }
+    free(frames);
+    return(response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drop_frames
+// Description  : Drops frames of a file from the cache. The cache is
+//                write-through, so nothing is lost.
+//
+// Inputs       : File, first frame, and number of frames
+// Outputs      : none
+
+void drop_frames(File *file, int first, int count) {
+    int i; //frame of file
+
+    for(i = first; i < first + count && i < CART_CARTRIDGE_SIZE; i++) {
+        if(file->data[i].cart != -1) delete_cart_cache(file->data[i].cart, file->data[i].frame);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_ahead
+// Description  : Reads ahead of a read of a sequential file. The window
+//                starts at CART_READAHEAD_MIN frames and doubles with each
+//                read that starts where the last one ended, up to
+//                CART_READAHEAD_MAX or a quarter of the cache, and starts
+//                over after a seek. Frames already read ahead are skipped.
+//
+// Inputs       : File, frame after the read, and whether read was in order
+// Outputs      : none
+
+void read_ahead(File *file, int next, int in_order) {
+    int limit = cache.max_cache_size / 4; //window must not flush the cache it fills
+    int first; //first frame to fetch
+
+    if(limit > CART_READAHEAD_MAX) limit = CART_READAHEAD_MAX;
+    if(in_order && file->readahead > 0) { //still in order, widen window
+        file->readahead = (file->readahead * 2 > limit) ? limit : file->readahead * 2;
+    } else { //first read, or read after a seek
+        file->readahead = (CART_READAHEAD_MIN > limit) ? limit : CART_READAHEAD_MIN;
+        file->readahead_next = next;
+    }
+    first = (file->readahead_next > next) ? file->readahead_next : next; //skip frames already fetched
+    if(next + file->readahead > first) {
+        prefetch_frames(file, first, next + file->readahead - first); //a failed prefetch only costs the read later
+        file->readahead_next = next + file->readahead;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : record_access
+// Description  : Traces a frame access and, when prefetching, learns it as
+//                the successor of the access before. Never calls the cache,
+//                so it is safe while a slot is reserved.
+//
+// Inputs       : cart, frame, and CART_TRACE_* operation
+// Outputs      : none
+
+void record_access(int16_t cart, int16_t frame, uint8_t op) {
+    cart_trace_record(cart, frame, op);
+    if(file_system.prefetch) prefetch_learn(CART_CACHE_KEY(cart, frame));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : predict_frames
+// Description  : Follows the learned successors of the last access up to
+//                CART_PREFETCH_DEPTH frames and reads the confident ones
+//                into the cache. A frame on another cart needs one more
+//                step of confidence, since it costs an LDCART now and
+//                another to come back. Predictions are charged to the
+//                partition of the file whose access they follow.
+//
+// Inputs       : part - cache partition of the file just accessed
+// Outputs      : none
+
+void predict_frames(int part) {
+    char buf[CART_FRAME_SIZE]; //frame read ahead
+    uint32_t key = prefetch_last(), next; //frame predicted from, its successor
+    int16_t cart, frame; //frame predicted
+    int depth, confidence; //frames predicted so far, confidence of successor
+
+    if(!file_system.prefetch || key == 0) return; //not prefetching, or nothing learned from
+    key--;
+    for(depth = 0; depth < CART_PREFETCH_DEPTH; depth++) {
+        confidence = prefetch_predict(key, &next);
+        cart = CART_CACHE_KEY_CART(next);
+        frame = CART_CACHE_KEY_FRAME(next);
+        if(confidence < CART_PREFETCH_CONFIDENCE + (cart != file_system.last_cart_loaded)) return; //not sure enough
+        if(cart >= CART_MAX_CARTRIDGES || frame >= CART_CARTRIDGE_SIZE) return;
+        if(file_system.visited[cart][frame] && !peek_cart_cache(cart, frame) && frame_cacheable(cart, frame, CART_LEASE_READ)) { //frame has data, isn't cached and may be
+            if(read_cart_frame(cart, frame, buf) == -1) return; //a failed prefetch only costs the read later
+            prefetch_cart_cache_part(cart, frame, buf, part);
+        }
+        key = next;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : warm_cache
+// Description  : Reads the frames of the cache snapshot back from the carts,
+//                in cart order so each cart is loaded once. Frames never
+//                written since poweron are zeros and are skipped, so after
+//                a format this reads nothing.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int warm_cache(void) {
+    uint32_t *keys = (uint32_t *) malloc(sizeof(uint32_t) * CART_CACHE_MRC_KEYS); //keys to prefetch
+    char buf[CART_FRAME_SIZE]; //frame read
+    int i, count, response = 0; //iterator, keys, response from cart
+    int16_t cart, frame; //frame to prefetch
+
+    if(keys == NULL) return(-1); //if allocation fails
+    count = cart_cache_warm_keys(keys, CART_CACHE_MRC_KEYS);
+    for(i = 0; i < count && response == 0; i++) {
+        cart = CART_CACHE_KEY_CART(keys[i]);
+        frame = CART_CACHE_KEY_FRAME(keys[i]);
+        if(cart >= CART_MAX_CARTRIDGES || frame >= CART_CARTRIDGE_SIZE || !file_system.visited[cart][frame]) continue; //nothing on cart to fetch
+        response = load_frame(cart, frame, buf, 0); //files and their partitions are gone
+    }
+    free(keys);
+    return(response);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : cart_poweron
@@ -119,13 +835,17 @@ int hash(char *str) {
 int32_t cart_poweron(void) {
     int i, j, k, start, start_cache, load, clear; //temporary variables
     start = run_opcode(generate_encoded_opcode(CART_OP_INITMS, 0, 0, 0), NULL); //initialize cart system
+    set_cart_cache_generation(0); //carts are formatted below, so no cached data from before survives, nor frames of other drivers in shared memory
+    cart_trace_record(0, 0, CART_TRACE_POWERON);
+    prefetch_reset(); //frames learned before are gone
     start_cache = init_cart_cache();
     if (start == -1 || start_cache == -1) { return(-1); } //if cart system fails to initialize, return -1
+    if(file_system.lease_port != 0 && lease_connect((cart_network_address == NULL) ? CART_DEFAULT_IP : (char *)cart_network_address,
+        file_system.lease_port, file_system.lease_granularity) == -1) { return(-1); } //cached frames can't be trusted without leases
 
     file_system.is_on = 1; //turns on file system
     file_system.current_handle = 0; //sets initial file handle
-    file_system.cart_to_use = 0; //sets initial cart
-    file_system.frame_to_use = 0; //sets initial frame
+    file_system.format_version = (file_system.format_version == 0) ? CART_FORMAT_VERSION : file_system.format_version; //format for new files
 
     for(i = 0; i < CART_MAX_CARTRIDGES; i++) { //clears all cartridges
         load = run_opcode(generate_encoded_opcode(CART_OP_LDCART, 0, i, 0), NULL); //loads cartridge
@@ -146,9 +866,12 @@ int32_t cart_poweron(void) {
         for(k = 0; k < CART_CARTRIDGE_SIZE; k++) { //iterates through frames
             file_system.visited[j][k] = 0; // sets each frame to 0 to signal unvisited
         }
+        for(k = 0; k < CART_MAP_WORDS; k++) { //iterates through free map
+            file_system.free_map[j][k] = ~0ULL; //every frame starts free
+        }
     }
 
-    return(0);
+    return(warm_cache()); //prefetch frames cached before last poweroff
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -164,6 +887,7 @@ int32_t cart_poweroff(void) {
     int off = run_opcode(generate_encoded_opcode(CART_OP_POWOFF, 0, 0, 0), NULL); //shuts down cart system
     int close_cache = close_cart_cache(); //closes cache
 
+    lease_disconnect(); //gives every lease back
     for(i = 0; i < FILES_SIZE; i++) { //close all files
         file_system.files[i].is_open = 0; //0 is close
     }
@@ -188,28 +912,31 @@ int16_t cart_open(char *path) {
     
     if(file_handle == -1) { //if file does not exist create a new one
         file_handle = file_system.current_handle; //gets a new, unused file handle
+        for(i = 0; file_handle >= FILES_SIZE && i < FILES_SIZE; i++) { //if handles ran out, reuse one from a deleted file
+            if(file_system.files[i].name[0] == '0') file_handle = i;
+        }
+        if(file_handle >= FILES_SIZE) return(-1); //no handles left
         File new_file; //creates a new file object
         strcpy(new_file.name, path); //copies file path
         new_file.handle = file_handle; //adds handle
         new_file.size = 0; //sets initial size
-        new_file.current_position = -1; //sets current position
+        new_file.current_position = 0; //sets current position
         new_file.is_open = 1; //sets open to 1
-        new_file.data[0].cart = file_system.cart_to_use; //initial cart is next available
-        new_file.data[0].frame = file_system.frame_to_use; // initial frame is next available
-        for(i = 1; i < CART_CARTRIDGE_SIZE; i++) {
-            new_file.data[i].cart = -1; //all other carts are -1, signifying unused
-            new_file.data[i].frame = -1; //all other frames are -1, signifying unused
+        new_file.format = file_system.format_version; //new files use current format
+        new_file.reserved = 0; //nothing reserved yet
+        new_file.partition = 0; //default cache partition
+        new_file.write_mode = CART_WRITE_DEFAULT; //follows driver's write mode
+        reset_advice(&new_file); //no access pattern known
+        for(i = 0; i < CART_CARTRIDGE_SIZE; i++) {
+            new_file.data[i].cart = -1; //all carts are -1, signifying unused until written
+            new_file.data[i].frame = -1; //all frames are -1, signifying unused until written
         }
         file_system.files[file_handle] = new_file; //adds new file to file system 
-        file_system.current_handle = file_handle + 1; //creates new unused file handle for next file
+        if(file_handle == file_system.current_handle) file_system.current_handle = file_handle + 1; //creates new unused file handle for next file
         file_system.all_handles[hashed] = file_handle; //adds handle to hashed list for O(1) access to handle based on path name    
-        file_system.frame_to_use++; //increments frame
-        if(file_system.frame_to_use == CART_CARTRIDGE_SIZE) { //if end of cart
-            file_system.cart_to_use++; //go to next cart
-            file_system.frame_to_use = 0; //set to first frame in cart
-        }
     } else if(file_system.files[file_handle].is_open == 0) { //if file isn't open
         file_system.files[file_handle].is_open = 1; //open file
+        reset_advice(&file_system.files[file_handle]); //advice lasts while file is open
     } else { //any other case
         return(-1); //fail
     }
@@ -231,6 +958,7 @@ int16_t cart_close(int16_t fd) {
         return(-1);
     }
     
+    release_reserved(&file_system.files[fd]); //trim frames reserved while file was growing
     file_system.files[fd].is_open = 0; //closes file system
 
     // Return successfully
@@ -250,57 +978,57 @@ int16_t cart_close(int16_t fd) {
 
 int32_t cart_read(int16_t fd, void *buf, int32_t count) {
     File *current = &file_system.files[fd]; //gets current file
-    int read_location_frame = current->current_position / (CART_FRAME_SIZE - 1); //gets starting frame
-    int read_location_bytes = current->current_position % (CART_FRAME_SIZE - 1); //gets position inside frame
-    char read_in[CART_FRAME_SIZE]; //frame to read from system
-    int i, response; //iterator and handles response
+    int payload = frame_payload(current); //bytes of file data per frame
+    int first_frame, frame_count, read_location_frame, read_location_bytes, chunk; //frames covered, frame, position inside frame and bytes taken from frame
+    int in_order; //whether read starts where last one ended
+    char *read_in; //frames read from system
     char *char_buf = (char *) buf; //converts void buf to char buf
-    char *stored_data; //stores data read
-    cache_node *read_cache; //reads data from cache
-
-    stored_data = (char *)malloc(sizeof(char)*count); //allocates data read to count size
-    read_cache = get_cart_cache(current->data[read_location_frame].cart, current->data[read_location_frame].frame); //get data from cache
-
-    if(read_cache != NULL) { //if data in cache, get data from cache
-        memcpy(read_in, read_cache->data, CART_FRAME_SIZE); //copy data into read_in
-    } else { //if no data in cache, get data from cart
-        if(file_system.last_cart_loaded != current->data[read_location_frame].cart) { //checks if cart is open
-            response = run_opcode(generate_encoded_opcode(CART_OP_LDCART, 0, current->data[read_location_frame].cart, 0), NULL); //opens cart
-            if(response == -1) return(-1); //if failed, return -1
-            file_system.last_cart_loaded = current->data[read_location_frame].cart; //sets last cart loaded
-        }
-        
-        response = run_opcode(generate_encoded_opcode(CART_OP_RDFRME, 0, 0, current->data[read_location_frame].frame), &read_in); //gets frame
-        if(response == -1) return(-1); //if call fails
-    }
-
-    for(i = 0; i < count; i++) { //iterates through bytes
-        if(read_location_bytes == CART_FRAME_SIZE-1){ //if finished reading frame
-            read_location_frame++; //move to next frame
-            read_location_bytes = 0; //start at pos 0 in frame
-            read_cache = get_cart_cache(current->data[read_location_frame].cart, current->data[read_location_frame].frame); //get data from cache
-            
-            if(read_cache != NULL) { //if data in cache
-                memcpy(read_in, read_cache->data, CART_FRAME_SIZE); //copy data into read in
-            } else { //if no data in cache
-                if(file_system.last_cart_loaded != current->data[read_location_frame].cart) { //checks if cart is open
-                    response = run_opcode(generate_encoded_opcode(CART_OP_LDCART, 0, current->data[read_location_frame].cart, 0), NULL);//opens cart
-                    if(response == -1) return(-1); //if failed, return -1
-                    file_system.last_cart_loaded = current->data[read_location_frame].cart; //sets last cart loaded
-                }
-                response = run_opcode(generate_encoded_opcode(CART_OP_RDFRME, 0, 0, current->data[read_location_frame].frame), &read_in);//get frame
-                if(response == -1) return(-1); //check if call succeeded
-            }
-        }
-        stored_data[i] = read_in[read_location_bytes]; //add frame data to stored data
-        read_location_bytes++; //go to next byte
+    int32_t bytes_read = 0; //bytes copied into buf
+
+    if(current->name[0] == '0' || current->is_open != 1) { //checks if file exists or is already closed
+        return(-1);
+    }
+
+    if(count > current->size - current->current_position) { //if read goes past end of file
+        count = current->size - current->current_position; //only read what is there
     }
+    if(count <= 0) { //nothing to read
+        return(0);
+    }
+
+    in_order = (current->current_position == current->last_read_end);
+    first_frame = current->current_position / payload; //first frame of read
+    frame_count = (current->current_position + count - 1) / payload - first_frame + 1; //frames read touches
+    read_in = (char *) malloc(frame_count * CART_FRAME_SIZE); //holds every frame of read
+    if(read_in == NULL) return(-1); //if allocation fails
+    if(load_frames(current, first_frame, frame_count, read_in) == -1) { //get frames in cart order
+        free(read_in);
+        return(-1); //if call fails
+    }
+
+    while(bytes_read < count) { //go frame by frame
+        read_location_frame = current->current_position / payload - first_frame; //gets frame
+        read_location_bytes = current->current_position % payload; //gets position inside frame
+        chunk = payload - read_location_bytes; //rest of frame
+        if(chunk > count - bytes_read) chunk = count - bytes_read; //or rest of read
 
-    memcpy(char_buf, stored_data, count); //copy info from stored data to buffer
-    free(stored_data); //release memory
+        memcpy(&char_buf[bytes_read], &read_in[read_location_frame * CART_FRAME_SIZE + read_location_bytes], chunk); //copy frame data into buf
+        bytes_read += chunk; //move along buf
+        current->current_position += chunk; //move along file
+    }
+
+    free(read_in); //release memory
+    current->last_read_end = current->current_position;
+
+    if(current->advice == CART_ADVICE_SEQUENTIAL) { //fetch what comes next before it is asked for
+        read_ahead(current, first_frame + frame_count, in_order);
+    } else if(current->advice == CART_ADVICE_NOREUSE) { //frames passed won't be read again
+        drop_frames(current, first_frame, current->current_position / payload - first_frame);
+    }
+    predict_frames(current->partition); //fetch what usually comes next
 
     // Return successfully
-	return (count);
+	return (bytes_read);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -316,66 +1044,63 @@ int32_t cart_read(int16_t fd, void *buf, int32_t count) {
 
 int32_t cart_write(int16_t fd, void *buf, int32_t count) {
     File *current = &file_system.files[fd]; //points to current file
-    int write_location_frame, write_location_bytes; //location to write and excess bytes
-    char read_in[CART_FRAME_SIZE] = { [0 ... CART_FRAME_SIZE-1] = '\0'}; //data read in from frame
-    char holding_buffer[CART_FRAME_SIZE] = { [0 ... CART_FRAME_SIZE-1] = '\0' }; //holds data to insert into frame
+    int payload = frame_payload(current); //bytes of file data per frame
+    int write_location_frame, write_location_bytes, chunk; //frame, position inside frame and bytes put in frame
     char *char_buf = (char *) buf; //converts void buf to char buf
-    int holding_buffer_count = 0; //counts index for holding_buffer
-    int response, i; //response for cart and iterating vari
-    cache_node *read_cache; //read data from cache
+    int32_t bytes_written = 0; //bytes copied from buf
+    int allocate, cached, tail; //whether write caches frames, frame is written in cache, write ends inside frame
+    int16_t cart, frame; //frame written
+    int first_frame = current->current_position / payload; //first frame of write
 
     if(file_system.files[fd].name[0] == '0' || file_system.files[fd].is_open != 1) { //checks if file exists or is already closed
         return(-1);
     }
+    if(current->current_position != current->last_write_end) current->write_run = 0; //write after a seek starts a new run
     
-    for(i = 0; i < count; i++) { //iterates through bytes to write
-        write_location_frame = current->current_position / (CART_FRAME_SIZE - 1); //gets frame to write
-        write_location_bytes = current->current_position % (CART_FRAME_SIZE - 1); //gets position to write
-        holding_buffer[holding_buffer_count] = char_buf[i]; //gets writing data
-        if((holding_buffer_count + write_location_bytes + 1) == (CART_FRAME_SIZE - 1) || i == (count - 1)) { //if max data reached or end of file
-            if(file_system.last_cart_loaded != current->data[write_location_frame].cart) { //checks if cart is open
-                response = run_opcode(generate_encoded_opcode(CART_OP_LDCART, 0, current->data[write_location_frame].cart, 0), NULL); //opens cart
-                if(response == -1) return(-1); //if failed, return -1
-                file_system.last_cart_loaded = current->data[write_location_frame].cart; //sets last cart loaded
-            }
-            
-            read_cache = get_cart_cache(current->data[write_location_frame].cart, current->data[write_location_frame].frame); //get data from cache
-            if(read_cache != NULL) { //if cache has data
-                memcpy(read_in, read_cache->data, CART_FRAME_SIZE); //copy data into cache
-            } else if(file_system.visited[current->data[write_location_frame].cart][current->data[write_location_frame].frame]){ //if unvisited
-                response = run_opcode(generate_encoded_opcode(CART_OP_RDFRME, 0, 0, current->data[write_location_frame].frame), &read_in); //read
-                if(response == -1) return(-1);//checks if successful
-            }
-
-            memcpy(&read_in[write_location_bytes], holding_buffer, holding_buffer_count+1);//copies new data
-            response = run_opcode(generate_encoded_opcode(CART_OP_WRFRME, 0, 0, current->data[write_location_frame].frame), &read_in);//writes frame
-            put_cart_cache(current->data[write_location_frame].cart, current->data[write_location_frame].frame, &read_in); //add data to cache
-            file_system.visited[current->data[write_location_frame].cart][current->data[write_location_frame].frame] = 1; //mark data as visited
+    while(bytes_written < count) { //go frame by frame
+        write_location_frame = current->current_position / payload; //gets frame to write
+        write_location_bytes = current->current_position % payload; //gets position to write
+        chunk = payload - write_location_bytes; //rest of frame
+        if(chunk > count - bytes_written) chunk = count - bytes_written; //or rest of write
 
-            if(response == -1) return(-1); //checks if successful
+        if(write_location_frame >= CART_CARTRIDGE_SIZE) return(-1); //file can't grow any larger
+        if(current->data[write_location_frame].cart == -1) { //if new frame needs to be allocated
+            if(grow_file(current, write_location_frame, (count - bytes_written + write_location_bytes + payload - 1) / payload) == -1) return(-1); //if no space left
+        }
 
-            current->current_position += (holding_buffer_count + 1); //update current position
-            if(current->current_position + 1 > current->size) { //checks if size changes
-                current->size = current->current_position + 1; //increases size
-            }
-            
-            holding_buffer_count = -1; //resets counter
-
-            if(current->current_position % (CART_FRAME_SIZE-1) == 0) { //checks if end of frame
-                if(current->current_position + 1 == current->size) { //if new frame needs to be allocated
-                    current->data[write_location_frame+1].cart = file_system.cart_to_use; //go to next cart to use
-                    current->data[write_location_frame+1].frame = file_system.frame_to_use; //go to next frame to use
-                    file_system.frame_to_use++; //increment frame
-                    if(file_system.frame_to_use == CART_CARTRIDGE_SIZE) { //if end of cart
-                        file_system.cart_to_use++; //go to new cart
-                        file_system.frame_to_use = 0; //go to first frame in cart 
-                    }
-                }
+        cart = current->data[write_location_frame].cart;
+        frame = current->data[write_location_frame].frame;
+        allocate = write_allocates(current);
+        tail = (write_location_bytes + chunk < payload);
+        cached = allocate || peek_cart_cache(cart, frame); //frames already cached are kept current in place
+        if(cached || tail) { //a frame the write ends inside is cached too, so the next append doesn't read it back
+            if(write_frame_in_place(cart, frame, write_location_bytes, &char_buf[bytes_written], chunk, current->partition) == -1) { //writes frame in its cache slot
+                return(-1); //checks if successful
             }
+        } else if(write_frame_around(cart, frame, write_location_bytes, &char_buf[bytes_written], chunk) == -1) { //writes frame to cart only
+            return(-1); //checks if successful
+        }
+        if(!allocate && tail && !cached) { //frame cached only until it is finished
+            current->write_tail = write_location_frame;
+        } else if(!allocate && !tail && write_location_frame == current->write_tail) { //finished, it goes as if written around
+            delete_cart_cache(cart, frame);
+            current->write_tail = -1;
+        }
+        if(!tail) current->write_run++; //one more frame filled in order
+
+        bytes_written += chunk; //move along buf
+        current->current_position += chunk; //update current position
+        if(current->current_position > current->size) { //checks if size changes
+            current->size = current->current_position; //increases size
         }
-        holding_buffer_count++; //increment counter
     }
 
+    current->last_write_end = current->current_position; //next write in order starts here
+    if(current->advice == CART_ADVICE_NOREUSE) { //frames passed won't be used again, the one still filling stays
+        drop_frames(current, first_frame, current->current_position / payload - first_frame);
+    }
+    predict_frames(current->partition); //fetch what usually comes next
+
     // Return successfully
 	return (count);
 }
@@ -396,7 +1121,7 @@ int32_t cart_seek(int16_t fd, uint32_t loc) {
         return(-1);
     }
    
-    if(loc+1 > current->size) { //checks if location is in bounds 
+    if(loc > current->size) { //checks if location is in bounds 
         return(-1);
     }
     
@@ -405,3 +1130,479 @@ int32_t cart_seek(int16_t fd, uint32_t loc) {
     // Return successfully
 	return (0);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_format
+// Description  : Select the on-cartridge format version used for new files.
+//                Files keep the format they were created with, so data in
+//                the original CART_FORMAT_V1 layout stays readable.
+//
+// Inputs       : version - CART_FORMAT_V1 or CART_FORMAT_V2
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_format(int version) {
+    if(version != CART_FORMAT_V1 && version != CART_FORMAT_V2) { //checks if format is known
+        return(-1);
+    }
+
+    file_system.format_version = version; //sets format for new files
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_unlink
+// Description  : Delete a file and give its frames back to the free map
+//
+// Inputs       : path - filename of the file to delete
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_unlink(char *path) {
+    int i, hashed = hash(path); //iterator and index for path
+    int file_handle = file_system.all_handles[hashed]; //gets file handle from hashed list
+    File *current; //file to delete
+
+    if(file_handle == -1) { //if file does not exist
+        return(-1);
+    }
+
+    current = &file_system.files[file_handle];
+    for(i = 0; i < CART_CARTRIDGE_SIZE; i++) { //release every frame file owns
+        if(current->data[i].cart != -1) {
+            release_frame(current->data[i].cart, current->data[i].frame);
+        }
+    }
+
+    current->name[0] = '0'; //file no longer exists
+    current->is_open = 0; //handle is no longer usable
+    file_system.all_handles[hashed] = -1; //path can be created again
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_truncate
+// Description  : Shrink or grow a file to exactly "size" bytes. Frames past
+//                the new end are freed, growing leaves a hole of zeros.
+//
+// Inputs       : fd - the file descriptor
+//                size - new size of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_truncate(int16_t fd, uint32_t size) {
+    File *current = &file_system.files[fd]; //current file
+    int payload = frame_payload(current); //bytes of file data per frame
+    int i, keep_frames, tail_bytes; //iterator, frames still needed and bytes used in last frame
+    char read_in[CART_FRAME_SIZE]; //last frame of file
+
+    if(current->name[0] == '0' || current->is_open != 1) { //checks if file exists or is already closed
+        return(-1);
+    }
+    if(size > (uint32_t)payload * CART_CARTRIDGE_SIZE) { //checks if size fits in a file
+        return(-1);
+    }
+
+    if(size < current->size) { //if shrinking
+        keep_frames = (size + payload - 1) / payload; //frames that still hold data
+        for(i = keep_frames; i < CART_CARTRIDGE_SIZE; i++) { //release frames past the end
+            if(current->data[i].cart != -1) {
+                release_frame(current->data[i].cart, current->data[i].frame);
+                current->data[i].cart = -1;
+                current->data[i].frame = -1;
+            }
+        }
+
+        tail_bytes = size % payload; //bytes used in the new last frame
+        if(tail_bytes != 0 && current->data[keep_frames-1].cart != -1) { //zero old data after the end so growing reads zeros
+            if(load_frame(current->data[keep_frames-1].cart, current->data[keep_frames-1].frame, read_in, current->partition) == -1) return(-1);
+            memset(&read_in[tail_bytes], 0, CART_FRAME_SIZE - tail_bytes);
+            if(store_frame(current->data[keep_frames-1].cart, current->data[keep_frames-1].frame, read_in, current->partition) == -1) return(-1);
+        }
+    }
+
+    current->size = size; //sets new size
+    if(current->reserved > current->size) { //reservation past new end was released
+        current->reserved = current->size;
+    }
+    if(current->current_position > current->size) { //position can't be past the end
+        current->current_position = current->size;
+    }
+
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_fallocate
+// Description  : Reserve frames for the first "len" bytes of a file without
+//                changing its size. Frames not yet allocated are taken as
+//                one contiguous run on one cart when possible, so a later
+//                sequential read needs a single LDCART.
+//
+// Inputs       : fd - the file descriptor
+//                len - number of bytes to reserve
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_fallocate(int16_t fd, uint32_t len) {
+    File *current = &file_system.files[fd]; //current file
+    int payload = frame_payload(current); //bytes of file data per frame
+    int i, first, frames; //iterator, first unallocated frame and frames needed
+
+    if(current->name[0] == '0' || current->is_open != 1) { //checks if file exists or is already closed
+        return(-1);
+    }
+    if(len > (uint32_t)payload * CART_CARTRIDGE_SIZE) { //checks if len fits in a file
+        return(-1);
+    }
+
+    frames = (len + payload - 1) / payload; //frames covering len
+    for(first = frames; first > 0 && current->data[first-1].cart == -1; first--); //unallocated frames at the end
+    if(frames > first && allocate_run(current, first, frames - first) == -1) { //try one run for the tail
+        for(i = first; i < frames; i++) { //otherwise take frames one by one
+            if(allocate_frame(current, i) == -1) return(-1);
+        }
+    }
+    for(i = 0; i < first; i++) { //fill any holes before the tail
+        if(current->data[i].cart == -1 && allocate_frame(current, i) == -1) return(-1);
+    }
+
+    if((int32_t)len > current->reserved) { //remember reservation so close keeps it
+        current->reserved = len;
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : layout_ldcarts
+// Description  : Estimates the LDCARTs needed to read a whole file in order,
+//                one for the first cart and one for every change of cart
+//
+// Inputs       : File
+// Outputs      : number of LDCARTs
+
+int layout_ldcarts(File *file) {
+    int frames = (file->size + frame_payload(file) - 1) / frame_payload(file); //frames holding data
+    int i, last_cart = -1, loads = 0; //iterator, cart of previous frame and LDCART count
+
+    for(i = 0; i < frames; i++) { //walk file in order
+        if(file->data[i].cart != -1 && file->data[i].cart != last_cart) { //holes don't need a cart
+            loads++; //cart changes
+            last_cart = file->data[i].cart;
+        }
+    }
+    return(loads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : defrag_file
+// Description  : Copies a file into one contiguous run of frames. The file's
+//                frame list is only replaced once every frame is copied, so
+//                a failure leaves the file as it was. Frames reserved with
+//                cart_fallocate are part of the new run, so they stay.
+//
+// Inputs       : File
+// Outputs      : 1 if moved, 0 if already contiguous or no room, -1 if failure
+
+int defrag_file(File *file) {
+    int frames = (file->size + frame_payload(file) - 1) / frame_payload(file); //frames holding data
+    int keep = (file->reserved + frame_payload(file) - 1) / frame_payload(file); //frames reserved by cart_fallocate
+    int i, response = 0, contiguous = 1; //iterator, response and whether file is already one run
+    char *read_in; //frames of file
+    File moved; //file with new frames
+
+    for(i = 0; i < frames; i++) { //check if file already is one run
+        if(file->data[i].cart == -1 || (i > 0 && (file->data[i].cart != file->data[0].cart || file->data[i].frame != file->data[0].frame + i))) {
+            contiguous = 0;
+        }
+    }
+    if(contiguous) return(0); //nothing to do
+    if(keep < frames) keep = frames; //new run holds data and reservation
+    if(keep > CART_CARTRIDGE_SIZE) keep = CART_CARTRIDGE_SIZE;
+
+    moved = *file; //copy file
+    for(i = 0; i < CART_CARTRIDGE_SIZE; i++) { //new frame list starts empty
+        moved.data[i].cart = -1;
+        moved.data[i].frame = -1;
+    }
+    if(allocate_run(&moved, 0, keep) == -1) return(0); //if no cart has room, leave file alone
+
+    read_in = (char *) malloc(frames * CART_FRAME_SIZE); //holds every frame of file
+    response = (read_in == NULL) ? -1 : load_frames(file, 0, frames, read_in); //read old frames in cart order
+    for(i = 0; i < frames && response == 0; i++) { //write new frames in order
+        response = store_frame(moved.data[i].cart, moved.data[i].frame, &read_in[i * CART_FRAME_SIZE], file->partition);
+    }
+    free(read_in); //release memory
+
+    if(response == -1) { //if copy failed, give back new frames
+        for(i = 0; i < keep; i++) release_frame(moved.data[i].cart, moved.data[i].frame);
+        return(-1);
+    }
+
+    for(i = 0; i < CART_CARTRIDGE_SIZE; i++) { //give back old frames, including reservations
+        if(file->data[i].cart != -1) release_frame(file->data[i].cart, file->data[i].frame);
+    }
+    memcpy(file->data, moved.data, sizeof(file->data)); //switch file over to new frames, reservation moves with it
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_defrag
+// Description  : Rewrite each file into one contiguous run of frames on one
+//                cart, so a full read needs a single LDCART. Files that are
+//                already contiguous or don't fit in any free run are left.
+//
+// Inputs       : ldcart_before - if not NULL, LDCARTs to read every file
+//                                before defragmenting
+//                ldcart_after - if not NULL, LDCARTs to read every file after
+// Outputs      : number of files moved if successful, -1 if failure
+
+int32_t cart_defrag(int32_t *ldcart_before, int32_t *ldcart_after) {
+    int i, response, before = 0, after = 0, moved = 0; //iterator, response, LDCART estimates and files moved
+
+    for(i = 0; i < file_system.current_handle; i++) { //go through every file
+        if(file_system.files[i].name[0] == '0') continue; //skip deleted files
+
+        before += layout_ldcarts(&file_system.files[i]);
+        response = defrag_file(&file_system.files[i]); //move file
+        if(response == -1) return(-1); //if copy failed
+        moved += response;
+        after += layout_ldcarts(&file_system.files[i]);
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "CART defrag moved %d files, estimated LDCARTs for full reads %d -> %d.", moved, before, after);
+    if(ldcart_before != NULL) *ldcart_before = before;
+    if(ldcart_after != NULL) *ldcart_after = after;
+    return(moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_layout
+// Description  : Describe where a file's frames live: its extents, the carts
+//                it spans, and the LDCARTs and bus round trips an uncached
+//                read of the whole file in order would cost
+//
+// Inputs       : fd - the file descriptor
+//                layout - filled in with the file's layout
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_layout(int16_t fd, CartLayout *layout) {
+    File *current = &file_system.files[fd]; //current file
+    int i, frames_read = 0; //iterator and frames that need a RDFRME
+    int carts_seen[CART_MAX_CARTRIDGES] = { 0 }; //carts file is on
+    struct extent_structure *extent = NULL; //extent being built
+
+    if(fd < 0 || fd >= FILES_SIZE || current->name[0] == '0') { //checks if file exists
+        return(-1);
+    }
+
+    layout->size = current->size;
+    layout->frames = (current->size + frame_payload(current) - 1) / frame_payload(current); //frames holding data
+    layout->extent_count = 0;
+    layout->carts_spanned = 0;
+
+    for(i = 0; i < layout->frames; i++) { //walk file in order
+        if(current->data[i].cart == -1) { //holes end an extent and cost nothing
+            extent = NULL;
+            continue;
+        }
+        if(extent != NULL && extent->cart == current->data[i].cart && extent->frame + extent->length == current->data[i].frame) {
+            extent->length++; //frame continues extent
+        } else { //frame starts new extent
+            extent = &layout->extents[layout->extent_count++];
+            extent->cart = current->data[i].cart;
+            extent->frame = current->data[i].frame;
+            extent->length = 1;
+        }
+        if(!carts_seen[current->data[i].cart]) { //first frame on this cart
+            carts_seen[current->data[i].cart] = 1;
+            layout->carts_spanned++;
+        }
+        if(file_system.visited[current->data[i].cart][current->data[i].frame]) frames_read++; //unwritten frames are never read
+    }
+
+    layout->ldcarts = layout_ldcarts(current);
+    layout->round_trips = layout->ldcarts + frames_read;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_prefetch
+// Description  : Learn which frame follows which and prefetch frames that
+//                are confidently predicted to come next
+//
+// Inputs       : enable - 1 to prefetch, 0 not to
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_prefetch(int enable) {
+    if(enable && !file_system.prefetch) prefetch_reset(); //learn from a clean table
+    file_system.prefetch = enable;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_advise
+// Description  : Tell the driver how a file will be used, in the spirit of
+//                posix_fadvise. WILLNEED prefetches the range into the
+//                cache and DONTNEED drops it; the others set the access
+//                pattern of the whole file until it is closed. A len of 0
+//                means to the end of the file.
+//
+// Inputs       : fd - the file handle
+//                off - offset of range in file
+//                len - bytes in range
+//                advice - CART_ADVICE_*
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_advise(int16_t fd, uint32_t off, uint32_t len, int advice) {
+    File *current = &file_system.files[fd]; //file advised on
+    int payload, first, count; //bytes of file data per frame, frames of range
+
+    if(fd < 0 || fd >= FILES_SIZE || current->name[0] == '0' || current->is_open != 1) { //checks if file exists or is already closed
+        return(-1);
+    }
+
+    payload = frame_payload(current);
+    if(off >= (uint32_t)current->size) { //range is past end of file
+        count = 0;
+        first = 0;
+    } else {
+        if(len == 0 || len > current->size - off) len = current->size - off; //range ends at end of file
+        first = off / payload;
+        count = (off + len - 1) / payload - first + 1;
+    }
+
+    switch(advice) {
+    case CART_ADVICE_NORMAL:
+    case CART_ADVICE_SEQUENTIAL:
+    case CART_ADVICE_RANDOM:
+    case CART_ADVICE_NOREUSE:
+        current->advice = advice; //pattern of whole file
+        current->readahead = 0; //window starts over
+        return(0);
+    case CART_ADVICE_WILLNEED:
+        return(prefetch_frames(current, first, count));
+    case CART_ADVICE_DONTNEED:
+        drop_frames(current, first, count);
+        return(0);
+    }
+    return(-1); //unknown advice
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_partition
+// Description  : Charge the cached frames of a file to a cache partition,
+//                whose quota is set with set_cart_cache_partition. Frames
+//                already cached move over the next time they are cached.
+//
+// Inputs       : fd - the file handle
+//                partition - cache partition, 0 for the default
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_partition(int16_t fd, int partition) {
+    if(fd < 0 || fd >= FILES_SIZE || file_system.files[fd].name[0] == '0' || file_system.files[fd].is_open != 1) { //checks if file exists and is open
+        return(-1);
+    }
+    if(partition < 0 || partition >= CART_CACHE_MAX_PARTITIONS) return(-1); //no such partition
+
+    file_system.files[fd].partition = partition; //cache is told on each put
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_open_tenant
+// Description  : Opens a file like cart_open, charging its cached frames to
+//                the cache partition of a tenant
+//
+// Inputs       : path - filename of the file to open
+//                tenant - cache partition of the tenant
+// Outputs      : file handle if successful, -1 if failure
+
+int16_t cart_open_tenant(char *path, int tenant) {
+    int16_t fd; //handle of file
+
+    if(tenant < 0 || tenant >= CART_CACHE_MAX_PARTITIONS) return(-1); //no such partition
+    if((fd = cart_open(path)) == -1) return(-1);
+    cart_set_partition(fd, tenant);
+    return(fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_write_mode
+// Description  : Select whether written frames are cached, for files that
+//                don't set their own mode. Write-allocate caches every
+//                written frame, no-write-allocate only updates frames
+//                already cached, and write-around-on-sequential caches
+//                writes until a file has written CART_WRITE_AROUND_RUN
+//                frames in order, so a bulk load doesn't flush the frames
+//                being read. The cache is write-through either way.
+//
+// Inputs       : mode - CART_WRITE_ALLOCATE, CART_WRITE_NO_ALLOCATE or
+//                       CART_WRITE_AROUND_SEQUENTIAL
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_write_mode(int mode) {
+    if(mode != CART_WRITE_ALLOCATE && mode != CART_WRITE_NO_ALLOCATE && mode != CART_WRITE_AROUND_SEQUENTIAL) { //checks if mode is known
+        return(-1);
+    }
+
+    file_system.write_mode = mode;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_file_write_mode
+// Description  : Select whether frames written to a file are cached, as
+//                cart_set_write_mode does for the driver. The mode stays
+//                with the file until it is set again.
+//
+// Inputs       : fd - the file handle
+//                mode - CART_WRITE_*, CART_WRITE_DEFAULT to follow the driver
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_file_write_mode(int16_t fd, int mode) {
+    if(fd < 0 || fd >= FILES_SIZE || file_system.files[fd].name[0] == '0' || file_system.files[fd].is_open != 1) { //checks if file exists and is open
+        return(-1);
+    }
+    if(mode != CART_WRITE_DEFAULT && mode != CART_WRITE_ALLOCATE && mode != CART_WRITE_NO_ALLOCATE && mode != CART_WRITE_AROUND_SEQUENTIAL) { //checks if mode is known
+        return(-1);
+    }
+
+    file_system.files[fd].write_mode = mode;
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_set_coherence
+// Description  : Keep the cached frames of this driver coherent with other
+//                clients through the lease server, from the next poweron.
+//                A frame is only cached while a lease on it (or on its cart,
+//                leasing whole cartridges) is held, and is dropped when the
+//                server takes the lease back for another client's write.
+//                Whole cartridges need fewer leases, frames conflict less.
+//
+// Inputs       : port - port of the lease server, 0 to stop
+//                granularity - CART_LEASE_FRAMES or CART_LEASE_CARTS
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t cart_set_coherence(unsigned short port, int granularity) {
+    if(file_system.is_on || (granularity != CART_LEASE_FRAMES && granularity != CART_LEASE_CARTS)) { //connects at poweron
+        return(-1);
+    }
+
+    file_system.lease_port = port;
+    file_system.lease_granularity = granularity;
+    return(0);
+}
@@ -17,6 +17,24 @@
 #define CART_MAX_TOTAL_FILES 1024 // Maximum number of files ever
 #define CART_MAX_PATH_LENGTH 128 // Maximum length of filename length
 #define FILES_SIZE CART_MAX_TOTAL_FILES * 5 //Huge size for ample space in hash table
+#define CART_FORMAT_V1 1 // Original layout, CART_FRAME_SIZE-1 bytes used per frame
+#define CART_FORMAT_V2 2 // Full layout, all CART_FRAME_SIZE bytes used per frame
+#define CART_FORMAT_VERSION CART_FORMAT_V2 // Format used for new files
+#define CART_MAP_WORDS (CART_CARTRIDGE_SIZE / 64) // 64-bit words in each cart's free map
+#define CART_PREALLOC_MAX_FRAMES 64 // Most frames reserved at once ahead of a growing file
+#define CART_ADVICE_NORMAL 0 // No expectation about the file's access pattern
+#define CART_ADVICE_SEQUENTIAL 1 // File is read in order, read ahead of each read
+#define CART_ADVICE_RANDOM 2 // File is read in no order, never read ahead
+#define CART_ADVICE_WILLNEED 3 // Range will be read soon, prefetch it now
+#define CART_ADVICE_DONTNEED 4 // Range won't be read soon, drop it from the cache
+#define CART_ADVICE_NOREUSE 5 // File data is used once, drop frames the position has passed
+#define CART_READAHEAD_MIN 4 // Frames read ahead when a sequential file starts
+#define CART_READAHEAD_MAX 64 // Most frames read ahead of a sequential file
+#define CART_WRITE_DEFAULT -1 // File follows the driver's write mode
+#define CART_WRITE_ALLOCATE 0 // Written frames are cached
+#define CART_WRITE_NO_ALLOCATE 1 // Written frames are cached only if they already were
+#define CART_WRITE_AROUND_SEQUENTIAL 2 // Written frames are cached until writes run in order, then go around
+#define CART_WRITE_AROUND_RUN 16 // Frames written in order before a file's writes go around the cache
 
 #include "cart_controller.h"
 
@@ -27,19 +45,49 @@ typedef struct file_structure {
     int32_t size; //file size
     int32_t current_position; //location in file
     int     is_open; //whether or not file is open
+    int     format; //on-cartridge format version of file
+    int32_t reserved; //bytes reserved with cart_fallocate
+    int     advice; //access pattern from cart_advise
+    int32_t readahead; //frames read ahead of last read, 0 until reads are in order
+    int32_t readahead_next; //first frame not yet read ahead
+    int32_t last_read_end; //position where last read ended, -1 if none
+    int     partition; //cache partition frames of file are charged to
+    int     write_mode; //CART_WRITE_* mode of file, CART_WRITE_DEFAULT to follow driver
+    int32_t write_run; //frames written in order since last out of order write
+    int32_t last_write_end; //position where last write ended, -1 if none
+    int32_t write_tail; //frame cached only until a write finishes it, -1 if none
     struct data_structure { //Data info of file
         int16_t cart; //cart
         int16_t frame; //frame
     } data[CART_CARTRIDGE_SIZE];
 } File;
 
+//LAYOUT STRUCT
+typedef struct layout_structure {
+    int32_t size; //file size
+    int32_t frames; //frames holding file data
+    int32_t extent_count; //number of extents
+    struct extent_structure { //run of frames in a row on one cart
+        int16_t cart; //cart of extent
+        int16_t frame; //first frame of extent
+        int16_t length; //frames in extent
+    } extents[CART_CARTRIDGE_SIZE];
+    int32_t carts_spanned; //distinct carts file is on
+    int32_t ldcarts; //LDCARTs to read whole file in order
+    int32_t round_trips; //bus requests to read whole file in order (LDCART + RDFRME)
+} CartLayout;
+
 //FILE SYSTEM STRUCT
 typedef struct file_system_structure {
-    int16_t cart_to_use; //cart to use for next file
-    int16_t frame_to_use; //frame to use for next file
+    uint64_t free_map[CART_MAX_CARTRIDGES][CART_MAP_WORDS]; //free frames in each cart (set bit = free)
     int16_t last_cart_loaded; //last loaded cart
     int is_on; //is system on
     int current_handle; //handle for next file
+    int format_version; //format version for new files
+    int prefetch; //whether to prefetch frames predicted from past accesses
+    int write_mode; //CART_WRITE_* mode of files that don't set their own
+    unsigned short lease_port; //port of lease server keeping caches coherent, 0 if none
+    int lease_granularity; //CART_LEASE_FRAMES or CART_LEASE_CARTS
     File files[FILES_SIZE]; //files in file system
     int all_handles[FILES_SIZE]; //all handles in file system
     int visited[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE];
@@ -71,6 +119,45 @@ int32_t cart_write(int16_t fd, void *buf, int32_t count);
 int32_t cart_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int32_t cart_unlink(char *path);
+	// Delete a file and give its frames back to the free map
+
+int32_t cart_truncate(int16_t fd, uint32_t size);
+	// Shrink or grow a file to exactly "size" bytes
+
+int32_t cart_fallocate(int16_t fd, uint32_t len);
+	// Reserve frames for the first "len" bytes of a file, contiguous if possible
+
+int32_t cart_defrag(int32_t *ldcart_before, int32_t *ldcart_after);
+	// Rewrite each file into one contiguous run of frames
+
+int32_t cart_layout(int16_t fd, CartLayout *layout);
+	// Describe where a file's frames live and what reading it costs
+
+int32_t cart_set_format(int version);
+	// Select the on-cartridge format version used for new files
+
+int32_t cart_set_prefetch(int enable);
+	// Learn which frame follows which and prefetch confidently predicted frames
+
+int32_t cart_advise(int16_t fd, uint32_t off, uint32_t len, int advice);
+	// Tell the driver how a file (or a range of it, for WILLNEED and DONTNEED) will be used
+
+int16_t cart_open_tenant(char *path, int tenant);
+	// Open a file whose cached frames are charged to the cache partition of "tenant"
+
+int32_t cart_set_partition(int16_t fd, int partition);
+	// Charge the cached frames of a file to a cache partition
+
+int32_t cart_set_write_mode(int mode);
+	// Select whether written frames are cached (CART_WRITE_*) for files that don't set their own
+
+int32_t cart_set_file_write_mode(int16_t fd, int mode);
+	// Select whether frames written to a file are cached, CART_WRITE_DEFAULT to follow the driver
+
+int32_t cart_set_coherence(unsigned short port, int granularity);
+	// Keep cached frames coherent with other clients through the lease server on "port", 0 to stop
+
 
 #endif
 
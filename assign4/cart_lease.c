@@ -0,0 +1,335 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_lease.c
+//  Description    : This is the client side of the lease protocol of the
+//                   CART driver. A cached frame may only be used while the
+//                   client holds a lease on it (or on its cartridge) from
+//                   the lease server: a read lease to read it, a write
+//                   lease to write it. Before granting a lease that
+//                   conflicts, the server invalidates the others, and the
+//                   client drops their cached frames and answers. Leases
+//                   last CART_LEASE_TERM_MS, so a client that doesn't
+//                   answer only holds the others up that long; the client
+//                   renews a lease before trusting it past its term.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+// Project includes
+#include <cart_lease.h>
+#include <cart_cache.h>
+#include <cart_network.h>
+#include <cmpsc311_util.h>
+#include <cmpsc311_log.h>
+// Defines
+
+//
+// Global data
+int lease_socket = -1; //connection to lease server, -1 if none
+struct sockaddr_in lease_address; //address of lease server, kept to reconnect
+int lease_granularity; //CART_LEASE_FRAMES or CART_LEASE_CARTS
+uint8_t lease_modes[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE + 1]; //lease held on each frame, and on each whole cart
+uint64_t lease_expires[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE + 1]; //time each lease must be renewed, in milliseconds
+uint32_t lease_checks; //lease checks, the server is polled every CART_LEASE_POLL_PERIOD
+LeaseStats lease_counters; //counters of protocol
+
+// Function Declarations
+uint64_t lease_now(void); //gets monotonic time in milliseconds
+int lease_open(void); //connects to server at lease_address
+int lease_send(CartXferRegister); //sends message to server
+int lease_receive(CartXferRegister*, int); //gets message from server
+void lease_lost(void); //forgets every lease after the connection fails
+void lease_drop_frames(CartridgeIndex, CartFrameIndex); //drops cached frames a lease covered
+void lease_invalidate(CartXferRegister); //gives a lease back to the server
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_now
+// Description  : Gets the monotonic time in milliseconds
+//
+// Inputs       : none
+// Outputs      : time in milliseconds
+
+uint64_t lease_now(void) {
+    struct timespec now; //current time
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_send
+// Description  : Sends a message to the lease server
+//
+// Inputs       : msg - the message
+// Outputs      : 0 if successful, -1 if failure
+
+int lease_send(CartXferRegister msg) {
+    CartXferRegister converted = htonll64(msg); //message in network bytes
+
+    if(send(lease_socket, &converted, sizeof(converted), MSG_NOSIGNAL) != sizeof(converted)) return(-1); //a server gone is an error, not a signal
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_receive
+// Description  : Gets a message from the lease server
+//
+// Inputs       : msg - where to put the message
+//                wait - 1 to wait for one, 0 to only take one already sent
+// Outputs      : 1 if a message was read, 0 if none waiting, -1 if failure
+
+int lease_receive(CartXferRegister *msg, int wait) {
+    ssize_t got = recv(lease_socket, msg, sizeof(*msg), MSG_PEEK | MSG_DONTWAIT); //bytes waiting
+
+    if(got == 0 || (got == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) return(-1); //server is gone, or connection failed
+    if(!wait && got < (ssize_t)sizeof(*msg)) return(0); //nothing whole waiting
+    if(recv(lease_socket, msg, sizeof(*msg), MSG_WAITALL) != sizeof(*msg)) return(-1);
+    *msg = ntohll64(*msg); //convert message to host bytes
+    return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_lost
+// Description  : Forgets every lease once the connection to the server
+//                fails. The server drops them too, so cached frames must
+//                not be trusted until leased again.
+//
+// Inputs       : none
+// Outputs      : none
+
+void lease_lost(void) {
+    logMessage(LOG_ERROR_LEVEL, "Lost connection to lease server, frames are read from the carts.");
+    close(lease_socket);
+    lease_socket = -1;
+    memset(lease_modes, 0, sizeof(lease_modes));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_drop_frames
+// Description  : Drops the cached frames a lease covered. A cart lease
+//                covers every frame of the cart not leased on its own.
+//
+// Inputs       : cart - cart of lease
+//                frm - frame of lease, CART_LEASE_WHOLE_CART for the cart
+// Outputs      : none
+
+void lease_drop_frames(CartridgeIndex cart, CartFrameIndex frm) {
+    int i; //frame of cart
+
+    lease_counters.dropped++;
+    if(frm != CART_LEASE_WHOLE_CART) {
+        delete_cart_cache(cart, frm);
+        return;
+    }
+    for(i = 0; i < CART_CARTRIDGE_SIZE; i++) {
+        if(lease_modes[cart][i] == CART_LEASE_NONE) delete_cart_cache(cart, i);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_invalidate
+// Description  : Gives a lease back when the server asks, dropping the
+//                cached frames it covered before answering, since another
+//                client is about to change them
+//
+// Inputs       : msg - invalidation from server
+// Outputs      : none
+
+void lease_invalidate(CartXferRegister msg) {
+    CartridgeIndex cart = CART_LEASE_MSG_CART(msg); //cart of lease
+    CartFrameIndex frm = CART_LEASE_MSG_FRAME(msg); //frame of lease
+
+    if(cart >= CART_MAX_CARTRIDGES || frm > CART_LEASE_WHOLE_CART) return; //not a lease of this driver
+    lease_counters.invalidations++;
+    lease_modes[cart][frm] = CART_LEASE_NONE;
+    lease_drop_frames(cart, frm);
+    if(lease_send(CART_LEASE_MSG(CART_LEASE_OP_ACK, 0, cart, frm)) == -1) lease_lost();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_open
+// Description  : Opens the connection to the lease server at lease_address
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lease_open(void) {
+    lease_socket = socket(PF_INET, SOCK_STREAM, 0);
+    if(lease_socket == -1) return(-1);
+    if(connect(lease_socket, (const struct sockaddr *)&lease_address, sizeof(lease_address)) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure connecting to lease server [%s:%u].", inet_ntoa(lease_address.sin_addr), ntohs(lease_address.sin_port));
+        close(lease_socket);
+        lease_socket = -1;
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_connect
+// Description  : Connect to the lease server. No lease is held yet, so
+//                every frame already cached is dropped when first leased.
+//
+// Inputs       : address - IP address of server
+//                port - port of server
+//                granularity - CART_LEASE_FRAMES or CART_LEASE_CARTS
+// Outputs      : 0 if successful, -1 if failure
+
+int lease_connect(const char *address, unsigned short port, int granularity) {
+    memset(&lease_address, 0, sizeof(lease_address));
+    lease_address.sin_family = AF_INET;
+    lease_address.sin_port = htons(port);
+    if(inet_aton(address, &lease_address.sin_addr) == 0) return(-1); //generate connection address
+    if(lease_open() == -1) return(-1);
+
+    lease_granularity = granularity;
+    lease_checks = 0;
+    memset(lease_modes, 0, sizeof(lease_modes));
+    memset(&lease_counters, 0, sizeof(lease_counters));
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_reconnect
+// Description  : Connect again after the connection to the server was
+//                lost. Every lease went with it, so each frame is leased
+//                anew, dropping what was cached meanwhile.
+//
+// Inputs       : none
+// Outputs      : 0 if connected, -1 if failure
+
+int lease_reconnect(void) {
+    if(lease_socket != -1) return(0); //still connected
+    if(lease_address.sin_family != AF_INET) return(-1); //never connected
+    if(lease_open() == -1) return(-1);
+    logMessage(LOG_WARNING_LEVEL, "Reconnected to lease server.");
+    memset(lease_modes, 0, sizeof(lease_modes));
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_disconnect
+// Description  : Close the connection, which gives every lease back
+//
+// Inputs       : none
+// Outputs      : none
+
+void lease_disconnect(void) {
+    if(lease_socket == -1) return; //not connected
+    close(lease_socket);
+    lease_socket = -1;
+    memset(lease_modes, 0, sizeof(lease_modes));
+    memset(&lease_address, 0, sizeof(lease_address)); //not to be reconnected
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_poll
+// Description  : Answer the invalidations the server has sent, without
+//                waiting for more. Leases stay safe without this, it only
+//                lets other clients go ahead sooner.
+//
+// Inputs       : none
+// Outputs      : none
+
+void lease_poll(void) {
+    CartXferRegister msg; //message from server
+    int got; //whether message was read
+
+    while(lease_socket != -1 && (got = lease_receive(&msg, 0)) != 0) {
+        if(got == -1) {
+            lease_lost();
+        } else if(CART_LEASE_MSG_OP(msg) == CART_LEASE_OP_INVAL) {
+            lease_invalidate(msg);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_acquire
+// Description  : Make sure a lease is held on a frame, or on its cart when
+//                leasing whole cartridges, taking or renewing it at the
+//                server if needed. Invalidations that arrive meanwhile are
+//                answered, so two clients waiting on each other both go
+//                ahead. A renewed lease keeps its cached frames, since the
+//                server invalidates before it answers; a new one drops
+//                them, they were cached without it.
+//
+// Inputs       : cart - the cartridge number of the frame
+//                frm - the frame number of the frame
+//                mode - CART_LEASE_READ or CART_LEASE_WRITE
+// Outputs      : 0 if the cached copy may be used and kept, -1 if not
+
+int lease_acquire(CartridgeIndex cart, CartFrameIndex frm, int mode) {
+    CartFrameIndex key = (lease_granularity == CART_LEASE_CARTS) ? CART_LEASE_WHOLE_CART : frm; //frame leased
+    CartXferRegister msg; //message to and from server
+    uint64_t sent; //time request was sent, lease is timed from here
+    int got; //whether answer was read
+
+    if(lease_socket == -1 || cart >= CART_MAX_CARTRIDGES) return(-1); //no server to lease from
+    if(++lease_checks % CART_LEASE_POLL_PERIOD == 0) lease_poll();
+    sent = lease_now();
+    if(lease_modes[cart][key] >= mode && sent < lease_expires[cart][key]) return(0); //held and not due
+
+    if(lease_modes[cart][key] > mode) mode = lease_modes[cart][key]; //renewal keeps a write lease
+    if(lease_send(CART_LEASE_MSG((mode == CART_LEASE_WRITE) ? CART_LEASE_OP_WRITE : CART_LEASE_OP_READ, 0, cart, key)) == -1) {
+        lease_lost();
+        return(-1);
+    }
+    lease_counters.requests++;
+    while((got = lease_receive(&msg, 1)) == 1 && CART_LEASE_MSG_OP(msg) == CART_LEASE_OP_INVAL) { //answer invalidations until server answers
+        lease_invalidate(msg);
+        if(lease_socket == -1) return(-1);
+    }
+    if(got == -1) {
+        lease_lost();
+        return(-1);
+    }
+
+    if(CART_LEASE_MSG_RT(msg) != 0) { //refused
+        lease_counters.refused++;
+        if(lease_modes[cart][key] != CART_LEASE_NONE) lease_drop_frames(cart, key);
+        lease_modes[cart][key] = CART_LEASE_NONE;
+        return(-1);
+    }
+    if(lease_modes[cart][key] == CART_LEASE_NONE) lease_drop_frames(cart, key); //new lease, or the old one was taken back
+    lease_modes[cart][key] = mode;
+    lease_expires[cart][key] = sent + CART_LEASE_TERM_MS - CART_LEASE_SLACK_MS; //server times it from later
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lease_stats
+// Description  : Get the counters of the lease protocol
+//
+// Inputs       : stats - where to put the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int lease_stats(LeaseStats *stats) {
+    if(stats == NULL) return(-1);
+    *stats = lease_counters;
+    return(0);
+}
@@ -0,0 +1,55 @@
+#ifndef CART_LEASE_INCLUDED
+#define CART_LEASE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_lease.h
+//  Description    : This is the header file for the client side of the lease
+//                   protocol, which keeps the frame caches of several CART
+//                   clients coherent.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdint.h>
+#include <cart_controller.h>
+// Defines
+#define CART_LEASE_NONE 0 // No lease held
+#define CART_LEASE_READ 1 // Shared lease, cached copies may be read
+#define CART_LEASE_WRITE 2 // Exclusive lease, frames may be written and cached
+#define CART_LEASE_FRAMES 0 // Lease each frame on its own
+#define CART_LEASE_CARTS 1 // Lease whole cartridges
+#define CART_LEASE_POLL_PERIOD 32 // Lease checks between looks for invalidations
+
+//LEASE STATS STRUCT
+typedef struct lease_stats { //counters from lease_stats
+    uint64_t requests; //leases taken or renewed at the server
+    uint64_t refused; //requests refused or lost with the connection
+    uint64_t invalidations; //leases the server took back
+    uint64_t dropped; //leases whose cached frames were dropped, taken back or new
+} LeaseStats;
+
+///
+// Lease Interfaces
+
+int lease_connect(const char *address, unsigned short port, int granularity);
+	// Connect to the lease server, leasing frames or whole cartridges (CART_LEASE_FRAMES, CART_LEASE_CARTS)
+
+int lease_reconnect(void);
+	// Connect again to the lease server after the connection was lost, 0 if connected
+
+void lease_disconnect(void);
+	// Give up every lease and close the connection
+
+int lease_acquire(CartridgeIndex cart, CartFrameIndex frm, int mode);
+	// Hold a CART_LEASE_READ or CART_LEASE_WRITE lease on a frame, 0 if its cached copy may be used
+
+void lease_poll(void);
+	// Answer the invalidations the server has sent, without waiting
+
+int lease_stats(LeaseStats *stats);
+	// Get the counters of the lease protocol
+
+#endif
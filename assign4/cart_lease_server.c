@@ -0,0 +1,449 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_lease_server.c
+//  Description    : This is a stand-in lease server for the CART lease
+//                   protocol, so several clients can cache the same frames
+//                   without reading stale data. It grants read leases to
+//                   any number of clients and write leases to one, on
+//                   frames or whole cartridges. A request that conflicts
+//                   with leases of other clients waits while they are
+//                   invalidated, until each answers or its lease runs out.
+//                   Requests are granted in the order they came in, so a
+//                   stream of readers can't starve a writer.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+// Project includes
+#include <cart_network.h>
+#include <cart_controller.h>
+#include <cmpsc311_util.h>
+#include <cmpsc311_log.h>
+// Defines
+#define CART_LEASE_ARGUMENTS "hvl:p:"
+#define USAGE \
+	"USAGE: cart_lease_server [-h] [-v] [-l <logfile>] [-p <port>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to take lease requests on\n" \
+	"\n" \
+
+#define CART_LEASE_NO_WRITER -1 // No client holds the write lease
+#define CART_LEASE_WAIT_MS 10 // Time between looks at requests waiting on a lease to run out
+#define CART_LEASE_BIT(client) ((uint64_t)1 << (client)) // Bit of a client in a lease mask
+
+//LEASE ENTRY STRUCT
+typedef struct lease_entry { //leases on one frame, or on a whole cart
+    uint64_t readers; //clients holding a read lease
+    int writer; //client holding the write lease, CART_LEASE_NO_WRITER if none
+    uint64_t invalidated; //holders sent an invalidation they haven't answered
+    uint64_t absorbed; //clients whose lease ran out before they answered, answer still to come
+    uint64_t expires; //time the last lease granted or renewed runs out, in milliseconds
+} lease_entry;
+
+//LEASE CLIENT STRUCT
+typedef struct lease_client { //connection of one client
+    int socket; //connection, -1 if slot is free
+    int waiting; //whether a request waits to be granted
+    uint64_t arrival; //order request came in
+    CartXferRegister request; //request waiting
+} lease_client;
+
+//
+// Global data
+int cart_network_shutdown = 0; //flag indicating shutdown
+lease_entry leases[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE + 1]; //leases on each frame, and on each whole cart
+lease_client clients[CART_LEASE_MAX_CLIENTS]; //connected clients
+uint64_t arrivals; //requests that came in
+uint64_t grants, invalidations, expirations; //counters of server
+
+// Function Declarations
+uint64_t server_now(void); //gets monotonic time in milliseconds
+int server_send(int, CartXferRegister); //sends message to client
+void server_drop_client(int); //gives back every lease of a client
+int region_busy(int, CartridgeIndex, CartFrameIndex, int, uint64_t); //invalidates leases a request conflicts with
+int requests_overlap(CartXferRegister, CartXferRegister); //whether two requests can't both be granted
+void grant_request(int, uint64_t); //grants request of client
+void serve_requests(void); //grants every waiting request that can be
+void handle_message(int, CartXferRegister); //acts on message from client
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the lease server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0;
+	unsigned short port = CART_DEFAULT_LEASE_PORT;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_LEASE_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			port = (unsigned short) atoi(optarg);
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// Serve leases until shut down
+	return( cart_lease_server(port) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_now
+// Description  : Gets the monotonic time in milliseconds
+//
+// Inputs       : none
+// Outputs      : time in milliseconds
+
+uint64_t server_now(void) {
+    struct timespec now; //current time
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_send
+// Description  : Sends a message to a client, dropping the client if it
+//                can't be reached
+//
+// Inputs       : client - the client
+//                msg - the message
+// Outputs      : 0 if successful, -1 if failure
+
+int server_send(int client, CartXferRegister msg) {
+    CartXferRegister converted = htonll64(msg); //message in network bytes
+
+    if(send(clients[client].socket, &converted, sizeof(converted), MSG_NOSIGNAL) != sizeof(converted)) { //a client gone mustn't kill the server
+        server_drop_client(client);
+        return(-1);
+    }
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : server_drop_client
+// Description  : Closes the connection of a client and gives back every
+//                lease it held. Its cache goes with it, so nothing needs
+//                to be invalidated.
+//
+// Inputs       : client - the client
+// Outputs      : none
+
+void server_drop_client(int client) {
+    uint64_t bit = CART_LEASE_BIT(client); //bit of client in masks
+    int i, j; //cart, frame
+
+    if(clients[client].socket == -1) return; //already dropped
+    for(i = 0; i < CART_MAX_CARTRIDGES; i++) {
+        for(j = 0; j <= CART_LEASE_WHOLE_CART; j++) {
+            leases[i][j].readers &= ~bit;
+            leases[i][j].invalidated &= ~bit;
+            leases[i][j].absorbed &= ~bit;
+            if(leases[i][j].writer == client) leases[i][j].writer = CART_LEASE_NO_WRITER;
+        }
+    }
+    close(clients[client].socket);
+    clients[client].socket = -1;
+    clients[client].waiting = 0;
+    logMessage(LOG_INFO_LEVEL, "Lease client %d disconnected.", client);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : region_busy
+// Description  : Checks whether a request of a client conflicts with the
+//                leases of others, on the frame and its cart (or on every
+//                frame, for a cart). Conflicting holders are invalidated,
+//                once, and those whose lease has run out are stripped of
+//                it; their answer is still expected, so a new lease isn't
+//                taken back by an old answer.
+//
+// Inputs       : client - client asking
+//                cart - cart of request
+//                frm - frame of request, CART_LEASE_WHOLE_CART for the cart
+//                write - whether a write lease is asked for
+//                now - current time
+// Outputs      : 1 if request must wait, 0 if it can be granted
+
+int region_busy(int client, CartridgeIndex cart, CartFrameIndex frm, int write, uint64_t now) {
+    lease_entry *entry; //leases of a frame in region
+    uint64_t others, fresh; //conflicting holders, those not yet invalidated
+    int first = (frm == CART_LEASE_WHOLE_CART) ? 0 : frm, j, i, busy = 0; //first frame of region, frame, client, whether to wait
+
+    for(j = first; j <= CART_LEASE_WHOLE_CART; j = (j == frm && frm != CART_LEASE_WHOLE_CART) ? CART_LEASE_WHOLE_CART : j + 1) { //frame then its cart
+        entry = &leases[cart][j];
+        if(entry->absorbed & CART_LEASE_BIT(client)) busy = 1; //own answer to an old invalidation is on its way
+        others = (write ? entry->readers : 0) | ((entry->writer == CART_LEASE_NO_WRITER) ? 0 : CART_LEASE_BIT(entry->writer));
+        others &= ~CART_LEASE_BIT(client);
+        if(others == 0) continue;
+
+        fresh = others & ~entry->invalidated;
+        for(i = 0; i < CART_LEASE_MAX_CLIENTS; i++) { //ask each holder to give its lease back
+            if((fresh & CART_LEASE_BIT(i)) && server_send(i, CART_LEASE_MSG(CART_LEASE_OP_INVAL, 0, cart, j)) == 0) {
+                entry->invalidated |= CART_LEASE_BIT(i);
+                invalidations++;
+            }
+        }
+        others &= (entry->readers | ((entry->writer == CART_LEASE_NO_WRITER) ? 0 : CART_LEASE_BIT(entry->writer))); //unreachable holders were dropped
+        if(others == 0) continue;
+        if(now >= entry->expires) { //leases ran out, holders can't be trusting them
+            entry->readers &= ~others;
+            if(entry->writer != CART_LEASE_NO_WRITER && (others & CART_LEASE_BIT(entry->writer))) entry->writer = CART_LEASE_NO_WRITER;
+            entry->absorbed |= others & entry->invalidated;
+            entry->invalidated &= ~others;
+            expirations++;
+        } else {
+            busy = 1;
+        }
+    }
+    return(busy);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : requests_overlap
+// Description  : Whether two requests can't both be granted, as they cover
+//                the same frame and one of them writes
+//
+// Inputs       : a, b - the requests
+// Outputs      : 1 if they conflict, 0 if not
+
+int requests_overlap(CartXferRegister a, CartXferRegister b) {
+    if(CART_LEASE_MSG_CART(a) != CART_LEASE_MSG_CART(b)) return(0);
+    if(CART_LEASE_MSG_FRAME(a) != CART_LEASE_MSG_FRAME(b) && CART_LEASE_MSG_FRAME(a) != CART_LEASE_WHOLE_CART &&
+        CART_LEASE_MSG_FRAME(b) != CART_LEASE_WHOLE_CART) return(0); //different frames
+    return(CART_LEASE_MSG_OP(a) == CART_LEASE_OP_WRITE || CART_LEASE_MSG_OP(b) == CART_LEASE_OP_WRITE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : grant_request
+// Description  : Grants the waiting request of a client and answers it
+//
+// Inputs       : client - the client
+//                now - current time
+// Outputs      : none
+
+void grant_request(int client, uint64_t now) {
+    CartXferRegister request = clients[client].request; //request granted
+    lease_entry *entry = &leases[CART_LEASE_MSG_CART(request)][CART_LEASE_MSG_FRAME(request)]; //leases it joins
+
+    if(CART_LEASE_MSG_OP(request) == CART_LEASE_OP_WRITE) { //write lease replaces a read lease of client
+        entry->writer = client;
+        entry->readers &= ~CART_LEASE_BIT(client);
+    } else if(entry->writer != client) { //a write lease already lets client read
+        entry->readers |= CART_LEASE_BIT(client);
+    }
+    if(entry->expires < now + CART_LEASE_TERM_MS) entry->expires = now + CART_LEASE_TERM_MS;
+    clients[client].waiting = 0;
+    grants++;
+    server_send(client, request); //answer is the request, return code 0
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serve_requests
+// Description  : Grants every waiting request that can be, oldest first. A
+//                request waits behind an older one it conflicts with.
+//
+// Inputs       : none
+// Outputs      : none
+
+void serve_requests(void) {
+    uint64_t now = server_now(); //current time
+    int order[CART_LEASE_MAX_CLIENTS], count = 0, i, j, k, blocked; //waiting clients oldest first, iterators, whether an older request conflicts
+    CartXferRegister request; //request looked at
+
+    for(i = 0; i < CART_LEASE_MAX_CLIENTS; i++) { //insertion sort by arrival
+        if(clients[i].socket == -1 || !clients[i].waiting) continue;
+        for(j = count; j > 0 && clients[order[j-1]].arrival > clients[i].arrival; j--) order[j] = order[j-1];
+        order[j] = i;
+        count++;
+    }
+
+    for(i = 0; i < count; i++) {
+        if(clients[order[i]].socket == -1 || !clients[order[i]].waiting) continue; //dropped while serving
+        request = clients[order[i]].request;
+        for(blocked = 0, k = 0; k < i && !blocked; k++) {
+            blocked = clients[order[k]].waiting && requests_overlap(clients[order[k]].request, request);
+        }
+        if(!blocked && !region_busy(order[i], CART_LEASE_MSG_CART(request), CART_LEASE_MSG_FRAME(request),
+            CART_LEASE_MSG_OP(request) == CART_LEASE_OP_WRITE, now)) {
+            grant_request(order[i], now);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : handle_message
+// Description  : Acts on a message from a client: a request waits to be
+//                served, an answer to an invalidation gives the lease back
+//
+// Inputs       : client - the client
+//                msg - the message
+// Outputs      : none
+
+void handle_message(int client, CartXferRegister msg) {
+    CartridgeIndex cart = CART_LEASE_MSG_CART(msg); //cart of message
+    CartFrameIndex frm = CART_LEASE_MSG_FRAME(msg); //frame of message
+    uint64_t bit = CART_LEASE_BIT(client); //bit of client in masks
+    lease_entry *entry; //leases of frame
+
+    if(cart >= CART_MAX_CARTRIDGES || frm > CART_LEASE_WHOLE_CART) { //no such frame
+        server_send(client, CART_LEASE_MSG(CART_LEASE_MSG_OP(msg), 1, cart, frm));
+        return;
+    }
+    entry = &leases[cart][frm];
+
+    switch(CART_LEASE_MSG_OP(msg)) {
+    case CART_LEASE_OP_READ:
+    case CART_LEASE_OP_WRITE:
+        clients[client].request = msg;
+        clients[client].arrival = arrivals++;
+        clients[client].waiting = 1;
+        break;
+    case CART_LEASE_OP_ACK:
+        if(entry->invalidated & bit) { //lease given back
+            entry->invalidated &= ~bit;
+            entry->readers &= ~bit;
+            if(entry->writer == client) entry->writer = CART_LEASE_NO_WRITER;
+        } else { //lease had already run out
+            entry->absorbed &= ~bit;
+        }
+        break;
+    default:
+        server_send(client, CART_LEASE_MSG(CART_LEASE_MSG_OP(msg), 1, cart, frm)); //unknown request
+        return;
+    }
+    serve_requests();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_lease_server
+// Description  : Serves leases to clients until killed
+//
+// Inputs       : port - port to take requests on
+// Outputs      : -1 if the server can't be started
+
+int cart_lease_server(unsigned short port) {
+    struct sockaddr_in saddr; //address to listen on
+    struct timeval wait; //time before looking at waiting requests again
+    CartXferRegister msg; //message from client
+    fd_set readable; //sockets with something to read
+    int listener, client, top, i, j, one = 1, any_waiting; //listening socket, new connection, highest socket, iterators, option, whether requests wait
+
+    for(i = 0; i < CART_MAX_CARTRIDGES; i++) {
+        for(j = 0; j <= CART_LEASE_WHOLE_CART; j++) leases[i][j].writer = CART_LEASE_NO_WRITER;
+    }
+    for(i = 0; i < CART_LEASE_MAX_CLIENTS; i++) clients[i].socket = -1;
+
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons(port);
+    saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    listener = socket(PF_INET, SOCK_STREAM, 0);
+    if(listener == -1) return(-1);
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(bind(listener, (struct sockaddr *)&saddr, sizeof(saddr)) == -1 || listen(listener, CART_MAX_BACKLOG) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure listening for lease clients on port %u.", port);
+        close(listener);
+        return(-1);
+    }
+    logMessage(LOG_INFO_LEVEL, "Lease server listening on port %u.", port);
+
+    while(!cart_network_shutdown) {
+        FD_ZERO(&readable);
+        FD_SET(listener, &readable);
+        top = listener;
+        any_waiting = 0;
+        for(i = 0; i < CART_LEASE_MAX_CLIENTS; i++) {
+            if(clients[i].socket == -1) continue;
+            FD_SET(clients[i].socket, &readable);
+            if(clients[i].socket > top) top = clients[i].socket;
+            any_waiting |= clients[i].waiting;
+        }
+        wait.tv_sec = 0;
+        wait.tv_usec = CART_LEASE_WAIT_MS * 1000;
+        if(select(top + 1, &readable, NULL, NULL, any_waiting ? &wait : NULL) == -1) break;
+
+        if(FD_ISSET(listener, &readable) && (client = accept(listener, NULL, NULL)) != -1) { //new client
+            for(i = 0; i < CART_LEASE_MAX_CLIENTS && clients[i].socket != -1; i++);
+            if(i == CART_LEASE_MAX_CLIENTS) { //no room to track its leases
+                logMessage(LOG_WARNING_LEVEL, "Refusing lease client, %d are connected.", CART_LEASE_MAX_CLIENTS);
+                close(client);
+            } else {
+                clients[i].socket = client;
+                clients[i].waiting = 0;
+                logMessage(LOG_INFO_LEVEL, "Lease client %d connected.", i);
+            }
+        }
+        for(i = 0; i < CART_LEASE_MAX_CLIENTS; i++) {
+            if(clients[i].socket == -1 || !FD_ISSET(clients[i].socket, &readable)) continue;
+            if(recv(clients[i].socket, &msg, sizeof(msg), MSG_WAITALL) != sizeof(msg)) { //client is gone
+                server_drop_client(i);
+                serve_requests(); //its leases no longer hold anyone up
+                continue;
+            }
+            handle_message(i, ntohll64(msg));
+        }
+        if(any_waiting) serve_requests(); //leases may have run out
+    }
+
+    logMessage(LOG_INFO_LEVEL, "Lease server done: %lu leases granted, %lu invalidations, %lu leases ran out.", grants, invalidations, expirations);
+    close(listener);
+    return(0);
+}
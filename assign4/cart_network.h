@@ -20,6 +20,29 @@
 #define CART_NET_HEADER_SIZE sizeof(CartXferRegister)
 #define CART_DEFAULT_IP "127.0.0.1"
 #define CART_DEFAULT_PORT 21785
+#define CART_DEFAULT_LEASE_PORT 21786 // Port of the lease server
+#define CART_LEASE_MAX_CLIENTS 64 // Most clients the lease server holds leases for
+#define CART_LEASE_TERM_MS 1000 // Time a lease lasts without renewal, or without an answer to its invalidation
+#define CART_LEASE_SLACK_MS 50 // Client gives a lease up this much before the server would
+#define CART_LEASE_WHOLE_CART CART_CARTRIDGE_SIZE // Frame number of a lease on a whole cartridge
+
+// Lease protocol messages, one CartXferRegister each, laid out like bus requests
+#define CART_LEASE_MSG(op, rt, cart, frm) (((CartXferRegister)(op) << 56) | ((CartXferRegister)(rt) << 47) | \
+                                           ((CartXferRegister)(cart) << 31) | ((CartXferRegister)(frm) << 15))
+#define CART_LEASE_MSG_OP(msg) ((int)((msg) >> 56)) // Opcode of a message
+#define CART_LEASE_MSG_RT(msg) ((int)(((msg) >> 47) & 0x1)) // Return code of a message, 0 if granted
+#define CART_LEASE_MSG_CART(msg) ((CartridgeIndex)(((msg) >> 31) & 0xffff)) // Cartridge of a message
+#define CART_LEASE_MSG_FRAME(msg) ((CartFrameIndex)(((msg) >> 15) & 0xffff)) // Frame of a message
+
+// These are the opcodes of the lease protocol, spoken with the lease server
+typedef enum {
+
+	CART_LEASE_OP_READ  = 0x10, // Take or renew a read lease, answered with the same message (client to server)
+	CART_LEASE_OP_WRITE = 0x11, // Take or renew a write lease, answered with the same message (client to server)
+	CART_LEASE_OP_INVAL = 0x12, // Give a lease back, cached copies are about to go stale (server to client)
+	CART_LEASE_OP_ACK   = 0x13  // Lease given back after an invalidation (client to server)
+
+} CartLeaseOpCodes;
 
 // Global data
 extern int            cart_network_shutdown; // Flag indicating shutdown
@@ -35,4 +58,7 @@ CartXferRegister client_cart_bus_request(CartXferRegister reg, void *buf);
 int cart_server( void );
 	// This is the implementation of the server application (cart_server.c)
 
+int cart_lease_server( unsigned short port );
+	// This is the implementation of the stand-in lease server (cart_lease_server.c)
+
 #endif
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_prefetch.c
+//  Description    : This is the frame successor table of the CART driver, a
+//                   first order model of which frame follows which. Each
+//                   frame keeps the frame last seen after it with a small
+//                   saturating confidence, so a one-off detour costs a
+//                   step of confidence instead of the learned successor.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <string.h>
+// Project includes
+#include <cart_prefetch.h>
+// Defines
+
+//
+// Global data
+prefetch_entry successors[CART_PREFETCH_TABLE]; //successor of each frame, direct mapped
+uint32_t last_access; //index key of last frame accessed, +1, 0 if none
+
+// Function Declarations
+prefetch_entry * successor_of(uint32_t); //gets table entry of frame
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : successor_of
+// Description  : Gets the table entry a frame maps to, which may belong to
+//                another frame
+//
+// Inputs       : key - index key of frame
+// Outputs      : the entry
+
+prefetch_entry * successor_of(uint32_t key) {
+    return(&successors[(key * 2654435761u) >> 18 & (CART_PREFETCH_TABLE - 1)]); //multiplicative hash
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_reset
+// Description  : Forget every learned successor
+//
+// Inputs       : none
+// Outputs      : none
+
+void prefetch_reset(void) {
+    memset(successors, 0, sizeof(successors));
+    last_access = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_learn
+// Description  : Note an access to a frame. The frame becomes the successor
+//                of the frame accessed before it, or strengthens it if it
+//                already was; a different frame first wears the confidence
+//                down. Repeated accesses to one frame count once.
+//
+// Inputs       : key - index key of frame
+// Outputs      : none
+
+void prefetch_learn(uint32_t key) {
+    prefetch_entry *entry; //entry of frame before
+
+    if(last_access == key + 1) return; //same frame again, as a merge reading then writing it
+    if(last_access != 0) {
+        entry = successor_of(last_access - 1);
+        if(entry->key != last_access) { //frame before has no entry yet, take the slot
+            entry->key = last_access;
+            entry->next = key;
+            entry->confidence = 0;
+        } else if(entry->next == key) { //same successor again
+            if(entry->confidence < CART_PREFETCH_MAX_CONFIDENCE) entry->confidence++;
+        } else if(entry->confidence > 0) { //other successor, doubt the learned one
+            entry->confidence--;
+        } else { //learned one had no confidence left
+            entry->next = key;
+        }
+    }
+    last_access = key + 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_last
+// Description  : Index key of the last frame accessed
+//
+// Inputs       : none
+// Outputs      : key + 1, 0 if none
+
+uint32_t prefetch_last(void) {
+    return(last_access);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : prefetch_predict
+// Description  : Get the learned successor of a frame
+//
+// Inputs       : key - index key of frame
+//                next - where to put index key of successor
+// Outputs      : confidence of successor, 0 if none learned
+
+int prefetch_predict(uint32_t key, uint32_t *next) {
+    prefetch_entry *entry = successor_of(key); //entry of frame
+
+    if(entry->key != key + 1) return(0); //nothing learned for frame
+    *next = entry->next;
+    return(entry->confidence);
+}
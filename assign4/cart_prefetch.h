@@ -0,0 +1,44 @@
+#ifndef CART_PREFETCH_INCLUDED
+#define CART_PREFETCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_prefetch.h
+//  Description    : This is the header file for the frame successor table
+//                   the CART driver uses to predict and prefetch frames.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdint.h>
+// Defines
+#define CART_PREFETCH_TABLE 16384 // Entries of the successor table, a power of two
+#define CART_PREFETCH_CONFIDENCE 2 // Times in a row a successor must follow before it is prefetched
+#define CART_PREFETCH_MAX_CONFIDENCE 3 // Most confidence a successor can build up
+#define CART_PREFETCH_DEPTH 2 // Most frames predicted ahead of an access
+
+//PREFETCH ENTRY STRUCT
+typedef struct prefetch_entry { //frame seen last after a frame
+    uint32_t key; //index key of frame + 1, 0 if empty
+    uint32_t next; //index key of frame that followed it
+    uint32_t confidence; //times in a row next followed, up to CART_PREFETCH_MAX_CONFIDENCE
+} prefetch_entry;
+
+///
+// Prefetch Interfaces
+
+void prefetch_reset(void);
+	// Forget every learned successor
+
+void prefetch_learn(uint32_t key);
+	// Note an access to a frame, learning it as the successor of the one before
+
+uint32_t prefetch_last(void);
+	// Index key of the last frame accessed, +1, 0 if none
+
+int prefetch_predict(uint32_t key, uint32_t *next);
+	// Get the learned successor of a frame and its confidence, 0 if none
+
+#endif
@@ -24,22 +24,45 @@
 // Project Includes
 #include <cart_driver.h>
 #include <cart_cache.h>
+#include <cart_trace.h>
 #include <cart_network.h>
+#include <cart_lease.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define CART_WORKLOAD_DIR "workload"
 #define CART_SIM_MAX_OPEN_FILES 128
-#define CART_ARGUMENTS "huvl:c:i:p:"
+#define CART_SIM_MRC_FIRST 16 // Smallest cache size of the printed miss ratio curve
+#define CART_ARGUMENTS "huvDLHTMAKFGl:c:P:S:B:V:X:W:R:a:w:Q:C:i:p:"
 #define USAGE \
-	"USAGE: cart_sim [-h] [-v] [-l <logfile>] [-c <sz>] <workload-file>\n" \
+	"USAGE: cart_sim [-h] [-v] [-D] [-L] [-H] [-l <logfile>] [-c <sz>] [-P <policy>] [-T] [-S <shards>] [-B <threads>] [-M] [-A] [-V <file>[:<frames>]] [-X <name>[:<frames>]] [-W <file>] [-K] [-R <file>] [-a <advice>] [-w <mode>] [-F] [-Q <min>:<max>] [-G] [-C <port>[:cart]] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
+	"    -D - defragment the files after the workload, before validating\n" \
+	"    -L - print the layout of each file on the cartridges\n" \
+	"    -H - use hugepages for the cart block cache\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
 	"    -c - set the cart block cache to size <sz> (disabled for assign #2)\n" \
+	"    -P - set the cart block cache replacement policy (LRU, CLOCK, 2Q, ARC)\n" \
+	"    -T - only cache new frames used more often than the frame they evict\n" \
+	"    -S - split the cart block cache into <shards> locked shards\n" \
+	"    -B - benchmark the cart block cache with up to <threads> threads (at most 1024)\n" \
+	"    -M - estimate and print the miss ratio curve of the cart block cache\n" \
+	"    -A - resize the cart block cache to the knee of its miss ratio curve\n" \
+	"    -V - keep frames evicted from the cart block cache in local <file>\n" \
+	"    -X - keep frames in shared memory segment <name>, not shared between clients since each formats the carts\n" \
+	"    -W - save the cart block cache to <file> at poweroff and warm it from there at poweron\n" \
+	"    -K - keep only frame numbers in the -W file, not frame data\n" \
+	"    -R - record every frame access to trace <file>, for cart_trace_sim\n" \
+	"    -a - advise the driver that every file is used as <advice> (normal, sequential, random, noreuse)\n" \
+	"    -w - cache written frames by <mode> (allocate, noallocate, around for write-around once writes run in order)\n" \
+	"    -F - prefetch frames predicted from the frames that followed them before\n" \
+	"    -Q - give each file its own cache partition, keeping <min> frames and holding at most <max> (0 for no limit)\n" \
+	"    -G - rebalance the cache partitions toward the file that would gain the most hits\n" \
+	"    -C - keep cached frames coherent with other clients through the lease server on <port>, leasing whole carts with :cart\n" \
 	"    -i - IP address of server to connect to.\n" \
 	"    -p - port number of server to connect to.\n" \
 	"\n" \
@@ -55,12 +78,19 @@ typedef struct {
 //
 // Global Data
 int verbose;
+int defragment; // Defragment files before validation
+int show_layout; // Print the layout of each file
+int file_advice = CART_ADVICE_NORMAL; // Access pattern given to the driver for every file
+int file_partitions = 0; // Whether each file gets its own cache partition
+uint32_t partition_min = 0, partition_max = 0; // Quota of each file's cache partition
 
 //
 // Functional Prototypes
 
 int simulate_CART( char *wload );             // control loop of the CART simulation
 int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+int print_layout(char *fname, int16_t mfh);   // Print where a file lives on the cartridges
+int print_cache_stats(void);                  // Print the cache counters of the run
 
 //
 // Functions
@@ -77,8 +107,11 @@ int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesyst
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
-	uint32_t cache_size = 0;
+	int ch, verbose = 0, log_initialized = 0, unit_tests = 0, bench_threads = 0, snapshot_payloads = 1, part;
+	char *snapshot = NULL, *trace = NULL;
+	uint32_t cache_size = 0, shards = 0, tier2_frames, shared_frames;
+	unsigned short lease_port;
+	char *sep;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, CART_ARGUMENTS)) != -1) {
@@ -92,6 +125,121 @@ int main( int argc, char *argv[] ) {
 			verbose = 1;
 			break;
 
+		case 'D': // Defragment Flag
+			defragment = 1;
+			break;
+
+		case 'L': // Layout Flag
+			show_layout = 1;
+			break;
+
+		case 'H': // Hugepage cache Flag
+			set_cart_cache_hugepages(1);
+			break;
+
+		case 'T': // Admission filter Flag
+			set_cart_cache_admission(1);
+			break;
+
+		case 'V': // Second tier cache file
+			tier2_frames = 0;
+			if ( (sep = strrchr(optarg, ':')) != NULL ) {
+				*sep = '\0';
+				if ( sscanf( sep+1, "%u", &tier2_frames ) != 1 ) {
+				    logMessage( LOG_ERROR_LEVEL, "Bad cache tier size [%s]", sep+1 );
+				    return(-1);
+				}
+			}
+			set_cart_cache_tier2(optarg, tier2_frames);
+			break;
+
+		case 'X': // Shared memory cache segment
+			shared_frames = 0;
+			if ( (sep = strrchr(optarg, ':')) != NULL ) {
+				*sep = '\0';
+				if ( sscanf( sep+1, "%u", &shared_frames ) != 1 ) {
+				    logMessage( LOG_ERROR_LEVEL, "Bad shared cache size [%s]", sep+1 );
+				    return(-1);
+				}
+			}
+			set_cart_cache_shared(optarg, shared_frames);
+			break;
+
+		case 'C': // Lease server keeping caches coherent
+			if ( sscanf( optarg, "%hu", &lease_port ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad lease server port [%s]", optarg );
+			    return(-1);
+			}
+			sep = strchr(optarg, ':');
+			cart_set_coherence(lease_port, (sep != NULL && strcmp(sep+1, "cart") == 0) ? CART_LEASE_CARTS : CART_LEASE_FRAMES);
+			break;
+
+		case 'W': // Cache snapshot file
+			snapshot = optarg;
+			break;
+
+		case 'R': // Access trace file
+			trace = optarg;
+			break;
+
+		case 'a': // File access pattern
+			if ( strcmp(optarg, "normal") == 0 ) {
+				file_advice = CART_ADVICE_NORMAL;
+			} else if ( strcmp(optarg, "sequential") == 0 ) {
+				file_advice = CART_ADVICE_SEQUENTIAL;
+			} else if ( strcmp(optarg, "random") == 0 ) {
+				file_advice = CART_ADVICE_RANDOM;
+			} else if ( strcmp(optarg, "noreuse") == 0 ) {
+				file_advice = CART_ADVICE_NOREUSE;
+			} else {
+			    logMessage( LOG_ERROR_LEVEL, "Bad file advice [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'w': // Write allocation mode
+			if ( strcmp(optarg, "allocate") == 0 ) {
+				cart_set_write_mode(CART_WRITE_ALLOCATE);
+			} else if ( strcmp(optarg, "noallocate") == 0 ) {
+				cart_set_write_mode(CART_WRITE_NO_ALLOCATE);
+			} else if ( strcmp(optarg, "around") == 0 ) {
+				cart_set_write_mode(CART_WRITE_AROUND_SEQUENTIAL);
+			} else {
+			    logMessage( LOG_ERROR_LEVEL, "Bad write mode [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'F': // Prefetch Flag
+			cart_set_prefetch(1);
+			break;
+
+		case 'Q': // Cache partition of each file
+			if ( sscanf( optarg, "%u:%u", &partition_min, &partition_max ) != 2 ||
+			     (partition_max != 0 && partition_min > partition_max) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad partition quota [%s]", optarg );
+			    return(-1);
+			}
+			file_partitions = 1;
+			break;
+
+		case 'G': // Rebalance partitions Flag
+			file_partitions = 1;
+			set_cart_cache_rebalance(1);
+			break;
+
+		case 'K': // Snapshot keys only Flag
+			snapshot_payloads = 0;
+			break;
+
+		case 'M': // Miss ratio curve Flag
+			set_cart_cache_mrc(1);
+			break;
+
+		case 'A': // Auto-tune cache size Flag
+			set_cart_cache_autotune(1);
+			break;
+
 		case 'u': // Unit test Flag
 			unit_tests = 1;
 			break;
@@ -107,6 +255,27 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
+		case 'P': // Set cache replacement policy
+			if ( set_cart_cache_policy(optarg) == -1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad cache policy [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'S': // Set cache shard count
+			if ( (sscanf( optarg, "%u", &shards ) != 1) || (set_cart_cache_shards(shards) == -1) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad cache shard count [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
+		case 'B': // Benchmark Flag
+			if ( (sscanf( optarg, "%d", &bench_threads ) != 1) || (bench_threads < 1) || (bench_threads > CART_CACHE_BENCH_MAX_THREADS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad benchmark thread count [%s]", optarg );
+			    return(-1);
+			}
+			break;
+
         case 'i': // Get the IP address
             if (inet_addr(optarg) == INADDR_NONE) {
 			    logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", argv[optind] );
@@ -140,9 +309,23 @@ int main( int argc, char *argv[] ) {
 	if (cache_size != 0) {
 		set_cart_cache_size(cache_size);
 	}
+	if (snapshot != NULL) {
+		set_cart_cache_snapshot(snapshot, snapshot_payloads);
+	}
+	for (part=1; part<CART_CACHE_MAX_PARTITIONS && file_partitions; part++) {
+		set_cart_cache_partition(part, partition_min, partition_max);
+	}
 
 	// If exgtracting file from data
-	if (unit_tests) {
+	if (bench_threads) {
+
+		// Run the cache benchmark
+		if ( cartCacheBenchmark(bench_threads) != 0 ) {
+			logMessage(LOG_ERROR_LEVEL, "Cache benchmark failed, aborting.\n\n");
+			return( -1 );
+		}
+
+	} else if (unit_tests) {
 
 		// Run the unit tests
 		enableLogLevels( LOG_INFO_LEVEL );
@@ -164,12 +347,18 @@ int main( int argc, char *argv[] ) {
 
 		}
 
+		// Start the access trace as needed
+		if ( (trace != NULL) && (cart_trace_open(trace) == -1) ) {
+			return( -1 );
+		}
+
 		// Run the simulation
 		if ( simulate_CART(argv[optind]) == 0 ) {
 			logMessage( LOG_INFO_LEVEL, "CART simulation completed successfully.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CART simulation failed.\n\n" );
 		}
+		cart_trace_close();
 	}
 
 	// Return successfully
@@ -256,13 +445,18 @@ int simulate_CART( char *wload ) {
 				CMPSC_ASSERT1(idx<CART_SIM_MAX_OPEN_FILES, "Too many open files on CART sim [%d]", idx);
 				ftable[idx].filename = strdup(fname);
 
-				// Now perform the open
-				ftable[idx].fhandle = cart_open(ftable[idx].filename);
+				// Now perform the open, in the file's own partition if asked
+				if (file_partitions) {
+					ftable[idx].fhandle = cart_open_tenant(ftable[idx].filename, idx%(CART_CACHE_MAX_PARTITIONS-1)+1);
+				} else {
+					ftable[idx].fhandle = cart_open(ftable[idx].filename);
+				}
 				if (ftable[idx].fhandle == -1) {
 					// Failed, error out
 					logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
 					return(-1);
 				}
+				cart_advise(ftable[idx].fhandle, 0, 0, file_advice);
 
 			}
 
@@ -365,6 +559,20 @@ int simulate_CART( char *wload ) {
 		}
 	}
 
+	// Defragment the files if asked to
+	if ( defragment && (cart_defrag(NULL, NULL) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "CART defragmentation failed, aborting." );
+		fclose( fhandle );
+		return( -1 );
+	}
+
+	// Print the layout of each file if asked to
+	for (i=0; show_layout && (i<CART_SIM_MAX_OPEN_FILES); i++) {
+		if (ftable[i].filename != NULL) {
+			print_layout(ftable[i].filename, ftable[i].fhandle);
+		}
+	}
+
 	// Now walk the the table of files to validate
 	for (i=0; i<CART_SIM_MAX_OPEN_FILES; i++) {
 		if (ftable[i].filename != NULL) {
@@ -376,6 +584,9 @@ int simulate_CART( char *wload ) {
 		}		
 	}
 
+	// Print the cache counters before the cache is closed
+	print_cache_stats();
+
 	// Shut down the interface
 	if (cart_poweroff() == -1) {
 		logMessage( LOG_ERROR_LEVEL, "CART simulator failed shutdown.");
@@ -472,3 +683,140 @@ int validate_file(char *fname, int16_t mfh) {
 	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
 	return( 0 );
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : print_layout
+// Description  : Print where a file's frames live on the cartridges and what
+//                an uncached sequential read of it costs
+//
+// Inputs       : fname - the name of the file
+//                mfh - the memory file handle
+// Outputs      : 0 if successful, -1 if failure
+
+int print_layout(char *fname, int16_t mfh) {
+
+	// Local variables
+	CartLayout *layout;
+	int idx;
+
+	// Get the layout from the driver
+	if ( (layout = malloc(sizeof(CartLayout))) == NULL ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure allocating layout for file [%s].", fname);
+		return(-1);
+	}
+	if (cart_layout(mfh, layout) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "Failure getting layout of file [%s].", fname);
+		free(layout);
+		return(-1);
+	}
+
+	// Print the summary and then each extent
+	logMessage(LOG_OUTPUT_LEVEL, "Layout of [%s]: %d bytes, %d frames, %d extents on %d carts, "
+		"sequential read costs %d LDCART, %d round trips", fname, layout->size, layout->frames,
+		layout->extent_count, layout->carts_spanned, layout->ldcarts, layout->round_trips);
+	for (idx=0; idx<layout->extent_count; idx++) {
+		logMessage(LOG_OUTPUT_LEVEL, "    extent %d: cart %d, frames %d-%d (%d frames)", idx,
+			layout->extents[idx].cart, layout->extents[idx].frame,
+			layout->extents[idx].frame+layout->extents[idx].length-1, layout->extents[idx].length);
+	}
+
+	// Free the layout, return successfully
+	free(layout);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : print_cache_stats
+// Description  : Print the cache counters of the run, in total and for each
+//                cartridge the cache saw
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int print_cache_stats(void) {
+
+	// Local variables
+	CacheStats *stats;
+	cache_cart_stats *cnt;
+	cache_partition_stats *part;
+	LeaseStats leases;
+	int idx;
+
+	// Get the counters from the cache
+	if ( (stats = malloc(sizeof(CacheStats))) == NULL ) {
+		logMessage(LOG_ERROR_LEVEL, "Failure allocating cache statistics.");
+		return(-1);
+	}
+	if (cart_cache_stats(stats) == -1) {
+		free(stats);
+		return(-1);
+	}
+
+	// Print the totals and then each cartridge
+	cnt = &stats->total;
+	logMessage(LOG_OUTPUT_LEVEL, "Cache [%s], %d/%d frames, %d shards: %lu hits, %lu misses, hit ratio %.2f%%, "
+		"%lu insertions, %lu evictions, %lu not admitted, %lu write-backs, %lu bytes saved", stats->policy,
+		stats->current_cache_size, stats->max_cache_size, stats->shard_count, cnt->hits, cnt->misses,
+		(cnt->hits+cnt->misses) ? 100.0*cnt->hits/(cnt->hits+cnt->misses) : 0.0, cnt->insertions,
+		cnt->evictions, cnt->rejected, stats->write_backs, stats->bytes_saved);
+	for (idx=0; idx<CART_MAX_CARTRIDGES; idx++) {
+		cnt = &stats->carts[idx];
+		if (cnt->hits+cnt->misses+cnt->insertions == 0) {
+			continue;
+		}
+		logMessage(LOG_OUTPUT_LEVEL, "    cart %d: %lu hits, %lu misses, hit ratio %.2f%%, %lu insertions, %lu evictions",
+			idx, cnt->hits, cnt->misses, (cnt->hits+cnt->misses) ? 100.0*cnt->hits/(cnt->hits+cnt->misses) : 0.0,
+			cnt->insertions, cnt->evictions);
+	}
+
+	// Print the prefetcher, if it ran
+	cnt = &stats->total;
+	if (cnt->prefetches) {
+		logMessage(LOG_OUTPUT_LEVEL, "    prefetch: %lu frames, %lu used (accuracy %.2f%%), %lu unused, coverage %.2f%%",
+			cnt->prefetches, cnt->prefetch_hits, 100.0*cnt->prefetch_hits/cnt->prefetches, cnt->prefetch_wasted,
+			(cnt->prefetch_hits+cnt->misses) ? 100.0*cnt->prefetch_hits/(cnt->prefetch_hits+cnt->misses) : 0.0);
+	}
+
+	// Print each partition the cache was split into, if it was
+	for (idx=0; idx<CART_CACHE_MAX_PARTITIONS && file_partitions; idx++) {
+		part = &stats->partitions[idx];
+		if (part->hits+part->misses+part->frames == 0) {
+			continue;
+		}
+		logMessage(LOG_OUTPUT_LEVEL, "    partition %d: %d frames, target %d, %lu hits, %lu misses, hit ratio %.2f%%, %lu evictions, %lu came back soon",
+			idx, part->frames, stats->partition_targets[idx], part->hits, part->misses,
+			(part->hits+part->misses) ? 100.0*part->hits/(part->hits+part->misses) : 0.0, part->evictions, part->ghost_hits);
+	}
+
+	// Print the second tier, if there is one
+	if (stats->tier2_frames) {
+		logMessage(LOG_OUTPUT_LEVEL, "    second tier, %d frames: %lu hits, %lu misses, %lu writes", stats->tier2_frames,
+			stats->tier2_hits, stats->tier2_misses, stats->tier2_writes);
+	}
+
+	// Print the shared memory tier, if there is one
+	if (stats->shared_frames) {
+		logMessage(LOG_OUTPUT_LEVEL, "    shared memory, %d frames: %lu hits, %lu misses, %lu stores", stats->shared_frames,
+			stats->shared_hits, stats->shared_misses, stats->shared_stores);
+	}
+
+	// Print the lease protocol, if caches were kept coherent
+	if (file_system.lease_port && lease_stats(&leases) == 0) {
+		logMessage(LOG_OUTPUT_LEVEL, "    leases: %lu requests, %lu refused, %lu taken back, %lu dropped cached frames",
+			leases.requests, leases.refused, leases.invalidations, leases.dropped);
+	}
+
+	// Print the estimated miss ratio curve, if it was sampled
+	if (cart_cache_miss_ratio(0) >= 0) {
+		for (idx=CART_SIM_MRC_FIRST; idx<=CART_MAX_CARTRIDGES*CART_CARTRIDGE_SIZE; idx*=2) {
+			logMessage(LOG_OUTPUT_LEVEL, "    miss ratio at %d frames: %.2f%%", idx, 100.0*cart_cache_miss_ratio(idx));
+		}
+		logMessage(LOG_OUTPUT_LEVEL, "    knee of miss ratio curve: %u frames", cart_cache_mrc_knee());
+	}
+
+	// Free the counters, return successfully
+	free(stats);
+	return( 0 );
+}
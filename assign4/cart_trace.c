@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_trace.c
+//  Description    : This is the frame access trace of the CART driver. Each
+//                   access is appended to a binary file as a small record,
+//                   timed in microseconds since the one before, so the trace
+//                   can be replayed offline by cart_trace_sim.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+// Project includes
+#include <cart_trace.h>
+#include <cart_controller.h>
+#include <cmpsc311_log.h>
+// Defines
+#define CART_TRACE_BUFFER (64 * 1024) // Bytes buffered before a write to the trace file
+
+//
+// Global data
+FILE *trace_file = NULL; //trace being written, NULL if none
+uint64_t trace_last; //time of last record in microseconds
+
+// Function Declarations
+uint64_t trace_now(void); //gets monotonic time in microseconds
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_now
+// Description  : Gets the monotonic time in microseconds
+//
+// Inputs       : none
+// Outputs      : time in microseconds
+
+uint64_t trace_now(void) {
+    struct timespec now; //current time
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return((uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_open
+// Description  : Start writing every frame access of the driver to a trace
+//                file, replacing any trace already there
+//
+// Inputs       : path - trace file
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_open(const char *path) {
+    CartTraceHeader header; //start of trace
+
+    if(trace_file != NULL) cart_trace_close(); //one trace at a time
+    if((trace_file = fopen(path, "wb")) == NULL) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening trace file [%s].", path);
+        return(-1);
+    }
+    setvbuf(trace_file, NULL, _IOFBF, CART_TRACE_BUFFER); //records are small, write them in large blocks
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CART_TRACE_MAGIC;
+    header.version = CART_TRACE_VERSION;
+    header.frame_size = CART_FRAME_SIZE;
+    header.start = (uint64_t)time(NULL);
+    if(fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+        fclose(trace_file);
+        trace_file = NULL;
+        return(-1);
+    }
+    trace_last = trace_now();
+    return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_close
+// Description  : Flush and close the trace file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int cart_trace_close(void) {
+    int ret; //result of close
+
+    if(trace_file == NULL) return(0); //no trace open
+    ret = (fclose(trace_file) == 0) ? 0 : -1;
+    trace_file = NULL;
+    return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cart_trace_record
+// Description  : Add a frame access to the trace. A failed write closes the
+//                trace rather than fail the access.
+//
+// Inputs       : cart - cart of frame
+//                frame - frame in cart
+//                op - CART_TRACE_* operation
+// Outputs      : none
+
+void cart_trace_record(int16_t cart, int16_t frame, uint8_t op) {
+    CartTraceRecord record; //access to add
+    uint64_t now, delta; //time of access, time since last record
+
+    if(trace_file == NULL) return; //not tracing
+    now = trace_now();
+    delta = now - trace_last;
+    trace_last = now;
+    record.delta = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t)delta; //gaps over an hour are clipped
+    record.cart = (uint16_t)cart;
+    record.frame = (uint16_t)frame;
+    record.op = op;
+    if(fwrite(&record, sizeof(record), 1, trace_file) != 1) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing trace, tracing stopped.");
+        cart_trace_close();
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef CART_TRACE_INCLUDED
+#define CART_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_trace.h
+//  Description    : This is the header file for the frame access trace of
+//                   the CART driver, written by the driver and replayed by
+//                   cart_trace_sim.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Includes
+#include <stdint.h>
+// Defines
+#define CART_TRACE_MAGIC 0x31525443 // "CTR1"
+#define CART_TRACE_VERSION 1 // Layout of trace file
+#define CART_TRACE_POWERON 0 // Carts were formatted, nothing is cached or written
+#define CART_TRACE_READ 1 // Frame was read, from cache or cart
+#define CART_TRACE_WRITE 2 // Whole frame was written to cart and cache
+#define CART_TRACE_FREE 3 // Frame was freed, cached copy dropped and frame zeroed
+
+//TRACE HEADER STRUCT
+typedef struct cart_trace_header { //start of trace file
+    uint32_t magic; //CART_TRACE_MAGIC
+    uint32_t version; //CART_TRACE_VERSION
+    uint32_t frame_size; //CART_FRAME_SIZE of writer
+    uint32_t reserved; //0
+    uint64_t start; //wall clock seconds when trace began
+} CartTraceHeader;
+
+//TRACE RECORD STRUCT
+typedef struct cart_trace_record { //one frame access, 9 bytes on file
+    uint32_t delta; //microseconds since previous record
+    uint16_t cart; //cart of frame
+    uint16_t frame; //frame in cart
+    uint8_t op; //CART_TRACE_* operation
+} __attribute__((packed)) CartTraceRecord;
+
+///
+// Trace Interfaces
+
+int cart_trace_open(const char *path);
+	// Start writing every frame access of the driver to a trace file
+
+int cart_trace_close(void);
+	// Flush and close the trace file
+
+void cart_trace_record(int16_t cart, int16_t frame, uint8_t op);
+	// Add an access to the trace, nothing if no trace is open
+
+#endif
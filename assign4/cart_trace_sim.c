@@ -0,0 +1,353 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : cart_trace_sim.c
+//  Description    : This is the offline cache simulator for the CART driver.
+//                   It replays a frame access trace recorded with cart_sim -R
+//                   against every replacement policy and cache size of
+//                   cart_cache.c, without a CART server, and prints the hit
+//                   ratio and the cart traffic each one would have caused.
+//
+//  Author         : Mayank Makwana
+//  Last Modified  : 11/22/2016
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+// Project Includes
+#include <cart_controller.h>
+#include <cart_cache.h>
+#include <cart_trace.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CART_TRACE_SIM_FIRST 16 // Smallest cache size replayed by default
+#define CART_TRACE_SIM_LAST 65536 // Largest cache size replayed by default
+#define CART_TRACE_SIM_MAX_SIZES 64 // Most cache sizes on the command line
+#define CART_ARGUMENTS "hvTl:c:P:S:"
+#define USAGE \
+	"USAGE: cart_trace_sim [-h] [-v] [-T] [-l <logfile>] [-c <sz>[,<sz>...]] [-P <policy>] [-S <shards>] <trace-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -T - only cache new frames used more often than the frame they evict\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -c - replay with these cache sizes (default every power of two from 16 to 65536)\n" \
+	"    -P - replay with this replacement policy only (default every policy)\n" \
+	"    -S - split the cache into <shards> locked shards\n" \
+	"\n" \
+	"    <trace-file> - trace written by cart_sim -R\n" \
+	"\n" \
+
+//REPLAY STRUCT
+typedef struct replay_result { //what one replay of the trace cost
+    uint64_t reads; //frame reads
+    uint64_t hits; //frame reads served by the cache
+    uint64_t ldcarts; //LDCART requests
+    uint64_t rdfrmes; //RDFRME requests
+    uint64_t wrfrmes; //WRFRME requests
+} ReplayResult;
+
+//
+// Global Data
+uint8_t written[CART_MAX_CARTRIDGES][CART_CARTRIDGE_SIZE]; // Frames holding data, as the driver's visited table
+
+//
+// Functional Prototypes
+
+CartTraceRecord * load_trace(char *fname, uint64_t *count);   // Read a whole trace into memory
+int replay_trace(CartTraceRecord *trace, uint64_t count, const char *policy, uint32_t frames, ReplayResult *result); // Replay a trace against one cache
+void print_result(const char *policy, uint32_t frames, ReplayResult *result); // Print one line of results
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CART trace simulator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0, size_count = 0, s, p;
+	uint32_t sizes[CART_TRACE_SIM_MAX_SIZES], size, shards;
+	const char *policy = NULL;
+	CartTraceRecord *trace;
+	ReplayResult result;
+	uint64_t count, i, reads = 0, writes = 0, frees = 0, elapsed = 0;
+	char *tok;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CART_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'T': // Admission filter Flag
+			set_cart_cache_admission(1);
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'c': // Set cache sizes
+			for ( tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ",") ) {
+				if ( (size_count == CART_TRACE_SIM_MAX_SIZES) || (sscanf(tok, "%u", &size) != 1) || (size == 0) ) {
+					fprintf( stderr, "Bad cache size [%s], aborting.\n", tok );
+					return( -1 );
+				}
+				sizes[size_count++] = size;
+			}
+			break;
+
+		case 'P': // Set cache replacement policy
+			if ( find_cart_cache_policy(optarg) == NULL ) {
+				fprintf( stderr, "Bad cache policy [%s], aborting.\n", optarg );
+				return( -1 );
+			}
+			policy = optarg;
+			break;
+
+		case 'S': // Set cache shard count
+			if ( (sscanf( optarg, "%u", &shards ) != 1) || (set_cart_cache_shards(shards) == -1) ) {
+				fprintf( stderr, "Bad cache shard count [%s], aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels(LOG_INFO_LEVEL);
+	}
+
+	// The filename should be the next option
+	if ( optind >= argc ) {
+		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+
+	// Default to every power of two
+	if ( size_count == 0 ) {
+		for ( size = CART_TRACE_SIM_FIRST; size <= CART_TRACE_SIM_LAST; size *= 2 ) {
+			sizes[size_count++] = size;
+		}
+	}
+
+	// Read the trace and describe it
+	if ( (trace = load_trace(argv[optind], &count)) == NULL ) {
+		return( -1 );
+	}
+	for ( i = 0; i < count; i++ ) {
+		reads += (trace[i].op == CART_TRACE_READ);
+		writes += (trace[i].op == CART_TRACE_WRITE);
+		frees += (trace[i].op == CART_TRACE_FREE);
+		elapsed += trace[i].delta;
+	}
+	printf( "Trace %s: %llu accesses (%llu reads, %llu writes, %llu frees) over %.3f seconds\n\n", argv[optind],
+		(unsigned long long)count, (unsigned long long)reads, (unsigned long long)writes, (unsigned long long)frees,
+		elapsed / 1000000.0 );
+	printf( "%-8s %8s %10s %10s %10s %10s\n", "policy", "frames", "hit ratio", "LDCART", "RDFRME", "WRFRME" );
+
+	// Replay without a cache, then with every policy and size
+	if ( replay_trace(trace, count, NULL, 0, &result) == -1 ) {
+		free( trace );
+		return( -1 );
+	}
+	print_result( "none", 0, &result );
+	for ( p = 0; cart_cache_policies[p].name != NULL; p++ ) {
+		if ( (policy != NULL) && (strcmp(policy, cart_cache_policies[p].name) != 0) ) {
+			continue;
+		}
+		for ( s = 0; s < size_count; s++ ) {
+			if ( replay_trace(trace, count, cart_cache_policies[p].name, sizes[s], &result) == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Replay with %s at %u frames failed.", cart_cache_policies[p].name, sizes[s] );
+				free( trace );
+				return( -1 );
+			}
+			print_result( cart_cache_policies[p].name, sizes[s], &result );
+		}
+	}
+
+	// Return successfully
+	free( trace );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : load_trace
+// Description  : Read a whole trace into memory, checking its header
+//
+// Inputs       : fname - the trace file
+//                count - where to put the number of records
+// Outputs      : the records (caller frees), NULL if failure
+
+CartTraceRecord * load_trace(char *fname, uint64_t *count) {
+
+	// Local variables
+	CartTraceHeader header;
+	CartTraceRecord *trace;
+	FILE *fhandle;
+	long bytes;
+
+	// Open the trace and check it was written for these frames
+	if ( (fhandle = fopen(fname, "rb")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening the trace file [%s], error: %s.", fname, strerror(errno) );
+		return( NULL );
+	}
+	if ( (fread(&header, sizeof(header), 1, fhandle) != 1) || (header.magic != CART_TRACE_MAGIC) ||
+		(header.version != CART_TRACE_VERSION) || (header.frame_size != CART_FRAME_SIZE) ) {
+		logMessage( LOG_ERROR_LEVEL, "Bad trace file [%s].", fname );
+		fclose( fhandle );
+		return( NULL );
+	}
+
+	// Read every record, a partial last record is dropped
+	fseek( fhandle, 0, SEEK_END );
+	bytes = ftell( fhandle ) - (long)sizeof(header);
+	fseek( fhandle, sizeof(header), SEEK_SET );
+	*count = bytes / sizeof(CartTraceRecord);
+	if ( (trace = (CartTraceRecord *) malloc(sizeof(CartTraceRecord) * (*count + 1))) == NULL ) {
+		fclose( fhandle );
+		return( NULL );
+	}
+	*count = fread( trace, sizeof(CartTraceRecord), *count, fhandle );
+	fclose( fhandle );
+	return( trace );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_trace
+// Description  : Replay a trace against one cache, the way the driver uses
+//                it: reads try the cache, then the cart if the frame holds
+//                data; writes go to the cart and the cache; frees drop the
+//                cached copy. A cart is loaded whenever a frame of another
+//                cart is sent or read.
+//
+// Inputs       : trace - the records
+//                count - number of records
+//                policy - replacement policy, NULL for no cache
+//                frames - cache size
+//                result - where to put the cost of the replay
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_trace(CartTraceRecord *trace, uint64_t count, const char *policy, uint32_t frames, ReplayResult *result) {
+
+	// Local variables
+	char frame[CART_FRAME_SIZE];
+	int last_cart = -1, cached = 0;
+	uint64_t i;
+
+	memset( result, 0, sizeof(ReplayResult) );
+	memset( frame, 0, sizeof(frame) );
+	memset( written, 0, sizeof(written) );
+	if ( policy != NULL ) {
+		set_cart_cache_policy( policy );
+		set_cart_cache_size( frames );
+	}
+	for ( i = 0; i < count; i++ ) {
+		if ( (policy != NULL) && !cached ) { // Cache for a trace begun after poweron
+			if ( init_cart_cache() == -1 ) {
+				return( -1 );
+			}
+			cached = 1;
+		}
+		if ( (trace[i].op != CART_TRACE_POWERON) &&
+			((trace[i].cart >= CART_MAX_CARTRIDGES) || (trace[i].frame >= CART_CARTRIDGE_SIZE)) ) {
+			continue;
+		}
+
+		switch ( trace[i].op ) {
+		case CART_TRACE_POWERON: // Carts formatted, cache starts empty
+			if ( cached && ((close_cart_cache() == -1) || (init_cart_cache() == -1)) ) {
+				return( -1 );
+			}
+			memset( written, 0, sizeof(written) );
+			result->ldcarts += CART_MAX_CARTRIDGES;
+			last_cart = CART_MAX_CARTRIDGES - 1;
+			break;
+
+		case CART_TRACE_READ: // Cache, then cart
+			result->reads++;
+			if ( cached && (get_cart_cache_copy(trace[i].cart, trace[i].frame, frame) == 0) ) {
+				result->hits++;
+			} else if ( written[trace[i].cart][trace[i].frame] ) {
+				result->ldcarts += (last_cart != trace[i].cart);
+				last_cart = trace[i].cart;
+				result->rdfrmes++;
+				if ( cached ) {
+					put_cart_cache( trace[i].cart, trace[i].frame, frame );
+				}
+			}
+			break;
+
+		case CART_TRACE_WRITE: // Cart and cache
+			result->ldcarts += (last_cart != trace[i].cart);
+			last_cart = trace[i].cart;
+			result->wrfrmes++;
+			written[trace[i].cart][trace[i].frame] = 1;
+			if ( cached ) {
+				put_cart_cache( trace[i].cart, trace[i].frame, frame );
+			}
+			break;
+
+		case CART_TRACE_FREE: // Cached copy dropped
+			written[trace[i].cart][trace[i].frame] = 0;
+			if ( cached ) {
+				delete_cart_cache( trace[i].cart, trace[i].frame );
+			}
+			break;
+		}
+	}
+
+	// Close any cache still open
+	if ( cached && (close_cart_cache() == -1) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : print_result
+// Description  : Print one line of results
+//
+// Inputs       : policy - name of replacement policy
+//                frames - cache size
+//                result - cost of the replay
+// Outputs      : none
+
+void print_result(const char *policy, uint32_t frames, ReplayResult *result) {
+	printf( "%-8s %8u %9.2f%% %10llu %10llu %10llu\n", policy, frames,
+		(result->reads == 0) ? 0.0 : 100.0 * result->hits / result->reads,
+		(unsigned long long)result->ldcarts, (unsigned long long)result->rdfrmes, (unsigned long long)result->wrfrmes );
+}